@@ -0,0 +1,370 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+#include "ipc.h"
+#include "utils.h"
+
+// Synthetic clients for benchmarking a running wm. Every measurement is
+// written as one line of key=value pairs so runs can be compared.
+
+#define CONNECT_TIMEOUT_NS 5000000000ull
+#define SETTLE_TIMEOUT_NS 2000000000ull
+#define DRAG_MOTIONS 10000
+#define WMC_RUNS 200
+#define SWITCH_RUNS 200
+
+struct Samples
+{
+  uint64_t* ns;
+  int count;
+};
+
+static xcb_connection_t* conn;
+static xcb_screen_t* screen;
+static xcb_window_t* windows;
+static int window_count;
+static int socket_fd = -1;
+static FILE* out;
+static const char* wmc_path;
+
+static void
+samples_init(struct Samples* s, int capacity)
+{
+  s->ns = malloc(sizeof(*s->ns) * capacity);
+  if (!s->ns)
+    die("Failed to allocate samples");
+  s->count = 0;
+}
+
+static int
+compare_ns(const void* a, const void* b)
+{
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+// Write a summary line and free the samples
+static void
+report(const char* metric, struct Samples* s)
+{
+  if (!s->count) {
+    free(s->ns);
+    return;
+  }
+
+  qsort(s->ns, s->count, sizeof(*s->ns), compare_ns);
+  uint64_t total = 0;
+  for (int i = 0; i < s->count; i++)
+    total += s->ns[i];
+
+  fprintf(out,
+          "windows=%d metric=%s count=%d mean_ns=%llu p50_ns=%llu "
+          "p99_ns=%llu max_ns=%llu\n",
+          window_count,
+          metric,
+          s->count,
+          (unsigned long long)(total / s->count),
+          (unsigned long long)s->ns[s->count / 2],
+          (unsigned long long)s->ns[(s->count - 1) * 99 / 100],
+          (unsigned long long)s->ns[s->count - 1]);
+  fflush(out);
+  free(s->ns);
+}
+
+// Round trip to the X server, everything sent before has been handled
+static void
+sync_x(void)
+{
+  free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL));
+}
+
+static void
+connect_wm(void)
+{
+  uint64_t deadline = now_ns() + CONNECT_TIMEOUT_NS;
+  while ((socket_fd = ipc_connect()) < 0) {
+    if (now_ns() > deadline)
+      die("Window manager is not listening on its socket");
+    usleep(10000);
+  }
+}
+
+// Run a command over the socket and wait until the X server has seen
+// what the wm sent for it
+static void
+run_command(int command, const int32_t* args)
+{
+  int status;
+  char text[IPC_MAX_MESSAGE];
+  int arg_count = commands[command].arg_count;
+
+  if (ipc_send_request(socket_fd, command, args, arg_count) < 0 ||
+      ipc_read_reply(socket_fd, &status, text, sizeof(text)) < 0)
+    die("Lost connection to window manager");
+  if (status != IPC_OK)
+    die("%s failed: %s", commands[command].name, text);
+
+  sync_x();
+}
+
+static xcb_generic_event_t*
+wait_for_event_until(uint64_t deadline)
+{
+  for (;;) {
+    xcb_generic_event_t* ev = xcb_poll_for_event(conn);
+    if (ev || xcb_connection_has_error(conn))
+      return ev;
+    if (now_ns() > deadline)
+      return NULL;
+    usleep(50);
+  }
+}
+
+// Time from mapping a window until the wm framed and mapped it
+static void
+bench_map(void)
+{
+  struct Samples s;
+  samples_init(&s, window_count);
+
+  uint32_t values[] = { XCB_EVENT_MASK_STRUCTURE_NOTIFY };
+  for (int i = 0; i < window_count; i++) {
+    windows[i] = xcb_generate_id(conn);
+    xcb_create_window(conn,
+                      XCB_COPY_FROM_PARENT,
+                      windows[i],
+                      screen->root,
+                      (i * 7) % 800,
+                      (i * 5) % 600,
+                      200,
+                      150,
+                      0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                      screen->root_visual,
+                      XCB_CW_EVENT_MASK,
+                      values);
+    sync_x();
+
+    uint64_t start = now_ns();
+    xcb_map_window(conn, windows[i]);
+    xcb_flush(conn);
+
+    // The wm maps the client once it sits in its frame
+    uint64_t deadline = start + SETTLE_TIMEOUT_NS;
+    xcb_generic_event_t* ev;
+    while ((ev = wait_for_event_until(deadline))) {
+      bool mapped = (ev->response_type & ~0x80) == XCB_MAP_NOTIFY &&
+                    ((xcb_map_notify_event_t*)ev)->window == windows[i];
+      free(ev);
+      if (mapped)
+        break;
+    }
+    if (!ev)
+      die("Window %d was not mapped", i);
+    s.ns[s.count++] = now_ns() - start;
+  }
+
+  report("map", &s);
+}
+
+static void
+bench_command(const char* metric, int command, int runs, int32_t arg)
+{
+  struct Samples s;
+  samples_init(&s, runs);
+
+  for (int i = 0; i < runs; i++) {
+    int32_t args[IPC_MAX_ARGS] = { arg };
+    uint64_t start = now_ns();
+    run_command(command, args);
+    s.ns[s.count++] = now_ns() - start;
+  }
+
+  report(metric, &s);
+}
+
+// Alternate between an empty workspace and the one holding the windows
+static void
+bench_switch(void)
+{
+  struct Samples s;
+  samples_init(&s, 2 * SWITCH_RUNS);
+
+  for (int i = 0; i < 2 * SWITCH_RUNS; i++) {
+    int32_t args[IPC_MAX_ARGS] = { i % 2 ? 0 : 1 };
+    uint64_t start = now_ns();
+    run_command(COMMAND_SWITCH_WORKSPACE, args);
+    s.ns[s.count++] = now_ns() - start;
+  }
+
+  report("switch", &s);
+}
+
+// Frame and header of the last mapped window
+static bool
+find_header(xcb_window_t* frame, xcb_window_t* header)
+{
+  xcb_window_t client = windows[window_count - 1];
+  xcb_query_tree_reply_t* tree =
+    xcb_query_tree_reply(conn, xcb_query_tree(conn, client), NULL);
+  if (!tree)
+    return false;
+  *frame = tree->parent;
+  free(tree);
+
+  tree = xcb_query_tree_reply(conn, xcb_query_tree(conn, *frame), NULL);
+  if (!tree)
+    return false;
+
+  *header = XCB_NONE;
+  xcb_window_t* children = xcb_query_tree_children(tree);
+  for (int i = 0; i < xcb_query_tree_children_length(tree); i++) {
+    if (children[i] != client)
+      *header = children[i];
+  }
+  free(tree);
+  return *header != XCB_NONE;
+}
+
+// Events sent to a window with no mask go to the client that created
+// it, so a drag on a header can be replayed without an input extension
+static void
+send_pointer(uint8_t type, xcb_window_t header, int16_t x, int16_t y)
+{
+  xcb_button_press_event_t ev = {
+    .response_type = type,
+    .detail = type == XCB_MOTION_NOTIFY ? 0 : XCB_BUTTON_INDEX_1,
+    .root = screen->root,
+    .event = header,
+    .root_x = x,
+    .root_y = y,
+    .event_x = x,
+    .event_y = y,
+    .state = type == XCB_BUTTON_PRESS ? 0 : XCB_BUTTON_MASK_1,
+    .same_screen = 1,
+  };
+  xcb_send_event(conn, 0, header, XCB_EVENT_MASK_NO_EVENT, (char*)&ev);
+}
+
+// Motion events per second the wm takes in while dragging a window
+static void
+bench_drag(void)
+{
+  xcb_window_t frame = XCB_NONE;
+  xcb_window_t header = XCB_NONE;
+  if (!find_header(&frame, &header))
+    die("Failed to find the header of a window");
+
+  xcb_get_geometry_reply_t* geom =
+    xcb_get_geometry_reply(conn, xcb_get_geometry(conn, frame), NULL);
+  if (!geom)
+    die("Failed to get the frame geometry");
+  int16_t x = geom->x;
+  int16_t y = geom->y;
+  free(geom);
+
+  uint64_t start = now_ns();
+  send_pointer(XCB_BUTTON_PRESS, header, 0, 0);
+  for (int i = 1; i <= DRAG_MOTIONS; i++)
+    send_pointer(XCB_MOTION_NOTIFY, header, i % 256, i % 128);
+  send_pointer(XCB_BUTTON_RELEASE, header, 0, 0);
+  xcb_flush(conn);
+
+  // The release lands the frame on the last motion however the wm
+  // paced the ones before
+  int16_t last_x = DRAG_MOTIONS % 256;
+  int16_t last_y = DRAG_MOTIONS % 128;
+  uint64_t deadline = start + SETTLE_TIMEOUT_NS;
+  for (;;) {
+    geom = xcb_get_geometry_reply(conn, xcb_get_geometry(conn, frame), NULL);
+    bool landed = geom && geom->x == x + last_x && geom->y == y + last_y;
+    free(geom);
+    if (landed)
+      break;
+    if (now_ns() > deadline)
+      die("Dragged window did not land");
+    usleep(100);
+  }
+
+  uint64_t elapsed = now_ns() - start;
+  fprintf(out,
+          "windows=%d metric=drag motions=%d elapsed_ns=%llu "
+          "motions_per_s=%llu\n",
+          window_count,
+          DRAG_MOTIONS,
+          (unsigned long long)elapsed,
+          (unsigned long long)(DRAG_MOTIONS * 1000000000ull / elapsed));
+  fflush(out);
+}
+
+// Whole wmc invocations, process start included
+static void
+bench_wmc(void)
+{
+  struct Samples s;
+  samples_init(&s, WMC_RUNS);
+
+  for (int i = 0; i < WMC_RUNS; i++) {
+    uint64_t start = now_ns();
+    pid_t pid = fork();
+    if (pid < 0)
+      die("Failed to fork: %s", strerror(errno));
+    if (pid == 0) {
+      execl(wmc_path, wmc_path, "focus-next", (char*)NULL);
+      _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0)
+      die("%s focus-next failed", wmc_path);
+    s.ns[s.count++] = now_ns() - start;
+  }
+
+  report("wmc", &s);
+}
+
+int
+main(int argc, char* argv[])
+{
+  if (argc != 4) {
+    fprintf(stderr, "Usage: bench WINDOWS RESULTS WMC\n");
+    return 1;
+  }
+
+  window_count = atoi(argv[1]);
+  if (window_count < 1)
+    die("Expected a positive window count: %s", argv[1]);
+  out = fopen(argv[2], "a");
+  if (!out)
+    die("Failed to open %s: %s", argv[2], strerror(errno));
+  wmc_path = argv[3];
+
+  windows = calloc(window_count, sizeof(*windows));
+  if (!windows)
+    die("Failed to allocate windows");
+
+  conn = xcb_connect(NULL, NULL);
+  if (xcb_connection_has_error(conn))
+    die("Failed to connect to X server");
+  screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+  connect_wm();
+
+  bench_map();
+  bench_command("focus-next", COMMAND_FOCUS_NEXT, window_count, 0);
+  bench_switch();
+  bench_drag();
+  bench_wmc();
+
+  close(socket_fd);
+  xcb_disconnect(conn);
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <xcb/xcb.h>
+
+#include "ipc.h"
+#include "log.h"
+#include "utils.h"
+#include "wm.h"
+#include "xreq.h"
+#include "xreq_fake.h"
+
+// Microbenchmarks of the wm handlers against the fake X server, so no
+// display is needed and nothing but the wm itself is measured. Every
+// measurement is written to stdout as one line of key=value pairs.
+
+#define DEFAULT_WINDOWS 1000
+#define DEFAULT_OPS 1000000
+#define SWITCH_DIVISOR 10 // Switches commit every time, so run fewer
+
+static int window_count;
+static xcb_window_t* clients;
+static uint64_t started;
+
+static void
+begin(void)
+{
+  xreq_fake_reset();
+  started = now_ns();
+}
+
+// Requests the fake server took since begin()
+static uint64_t
+requests(void)
+{
+  uint64_t total = 0;
+  for (int opcode = 0; opcode < 256; opcode++)
+    total += xreq_fake_count(opcode);
+  return total;
+}
+
+static void
+report(const char* metric, unsigned long ops)
+{
+  uint64_t elapsed = now_ns() - started;
+  uint64_t sent = requests();
+  printf("windows=%d metric=%s ops=%lu ns_per_op=%.1f ops_per_s=%.0f "
+         "requests_per_op=%.2f\n",
+         window_count,
+         metric,
+         ops,
+         (double)elapsed / ops,
+         elapsed ? ops * 1e9 / elapsed : 0.0,
+         (double)sent / ops);
+  fflush(stdout);
+}
+
+// Hand the wm whatever the fake server queued, as one batch
+static void
+drain(void)
+{
+  xcb_generic_event_t* ev;
+  while ((ev = xreq_poll_for_event(NULL))) {
+    wm_dispatch(ev);
+    free(ev);
+  }
+  wm_commit();
+}
+
+// Map every client, one batch each: request, geometry reply, framing
+static void
+bench_map(void)
+{
+  for (int i = 0; i < window_count; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "client %d", i);
+    clients[i] =
+      xreq_fake_create_client(name, 10 * (i % 64), 10 * (i % 48), 640, 480);
+  }
+
+  begin();
+  for (int i = 0; i < window_count; i++) {
+    xreq_fake_map_request(clients[i]);
+    drain();
+  }
+  report("map", window_count);
+
+  for (int i = 0; i < window_count; i++) {
+    const struct FakeWindow* win = xreq_fake_window(clients[i]);
+    if (!win || win->parent == FAKE_ROOT || !win->mapped)
+      die("Client %u was not framed", clients[i]);
+  }
+}
+
+// A managed client mapping itself again is looked up and forwarded
+static void
+bench_find(unsigned long ops)
+{
+  xcb_generic_event_t ev = { 0 };
+  xcb_map_request_event_t* map = (xcb_map_request_event_t*)&ev;
+  map->response_type = XCB_MAP_REQUEST;
+  map->parent = FAKE_ROOT;
+
+  begin();
+  for (unsigned long i = 0; i < ops; i++) {
+    map->window = clients[(i * 7919) % window_count];
+    wm_dispatch(&ev);
+  }
+  report("find", ops);
+}
+
+static void
+bench_focus(unsigned long ops)
+{
+  uint32_t args[IPC_MAX_ARGS] = { 0 };
+
+  begin();
+  for (unsigned long i = 0; i < ops; i++) {
+    wm_execute(COMMAND_FOCUS_NEXT, args);
+    wm_commit();
+  }
+  report("focus-next", ops);
+}
+
+static void
+bench_switch(unsigned long ops)
+{
+  uint32_t args[IPC_MAX_ARGS] = { 0 };
+
+  begin();
+  for (unsigned long i = 0; i < ops; i++) {
+    args[0] = (i + 1) % 2;
+    wm_execute(COMMAND_SWITCH_WORKSPACE, args);
+    wm_commit();
+  }
+  report("switch", ops);
+}
+
+// Clients go away one batch at a time, frames and headers with them
+static void
+bench_destroy(void)
+{
+  begin();
+  for (int i = 0; i < window_count; i++) {
+    xreq_fake_destroy_client(clients[i]);
+    drain();
+  }
+  report("destroy", window_count);
+}
+
+int
+main(int argc, char* argv[])
+{
+  if (argc > 3) {
+    fprintf(stderr, "Usage: micro [WINDOWS [OPS]]\n");
+    return 1;
+  }
+
+  window_count = argc > 1 ? atoi(argv[1]) : DEFAULT_WINDOWS;
+  long ops = argc > 2 ? atol(argv[2]) : DEFAULT_OPS;
+  if (window_count < 1 || ops < SWITCH_DIVISOR)
+    die("Expected a positive window count and at least %d ops",
+        SWITCH_DIVISOR);
+
+  clients = calloc(window_count, sizeof(*clients));
+  if (!clients)
+    die("Failed to allocate clients");
+
+  // Defaults only, a personal config would skew the numbers
+  setenv("WM_CONFIG", "/dev/null", 1);
+  xreq_use(&xreq_fake);
+  log_start();
+  wm_setup(argv[0], -1);
+
+  bench_map();
+  bench_find(ops);
+  bench_focus(ops);
+  bench_switch(ops / SWITCH_DIVISOR);
+  bench_destroy();
+
+  wm_shutdown();
+  log_stop();
+  free(clients);
+  return 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Benchmark wm under Xvfb for growing window counts. Results are
+# appended to $BENCH_RESULTS, one key=value line per measurement.
+set -eu
+
+cd "$(dirname "$0")/.."
+
+results=${BENCH_RESULTS:-bench/results.txt}
+counts=${BENCH_WINDOWS:-100 1000 5000}
+
+tmp=$(mktemp -d)
+displayfile="$tmp/display"
+
+# Defaults only, a personal config would skew the numbers
+export WM_CONFIG="$tmp/config"
+
+Xvfb -displayfd 3 -screen 0 1920x1080x24 -nolisten tcp \
+  3>"$displayfile" 2>/dev/null &
+xvfb=$!
+trap 'kill $xvfb 2>/dev/null; rm -rf "$tmp"' EXIT
+
+while [ ! -s "$displayfile" ]; do
+  kill -0 $xvfb 2>/dev/null || { echo "Xvfb failed to start" >&2; exit 1; }
+  sleep 0.05
+done
+export DISPLAY=":$(cat "$displayfile")"
+
+echo "# $(date -u +%Y-%m-%dT%H:%M:%SZ) $(git rev-parse --short HEAD \
+  2>/dev/null || echo unknown)" >>"$results"
+
+for n in $counts; do
+  ./wm 2>/dev/null &
+  wm=$!
+  bench/bench "$n" "$results" ./wmc
+  ./wmc quit >/dev/null 2>&1 || kill $wm
+  wait $wm || true
+done
+
+echo "Results appended to $results"
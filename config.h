@@ -1,6 +1,9 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+// Defaults, most of which the config file can override at runtime (see
+// settings.h)
+
 // Decorations
 #define HEADER_SIZE 20 // Window header size in pixels
 #define BORDER_SIZE 1  // Window border size in pixels
@@ -10,8 +13,25 @@
 #define UNFOCUSED_HEADER_COLOR 0x00FF00 // Green header
 #define FOCUSED_BORDER_COLOR 0x0000FF   // Blue border
 #define FOCUSED_HEADER_COLOR 0x00FFFF   // Cyan header
+#define UNFOCUSED_TITLE_COLOR 0x000000  // Black title
+#define FOCUSED_TITLE_COLOR 0x000000    // Black title
+
+// Titles
+#define TITLE_FONT "fixed" // Core X font
+#define TITLE_PADDING 4    // Space left of the title in pixels
 
 // Workspace
 #define MAX_WORKSPACES 10
+#define WORKSPACE_PARKING false // Move hidden workspaces offscreen, not unmap
+
+// Tiling
+#define DEFAULT_LAYOUT LAYOUT_FLOATING // Layout of every workspace at startup
+#define LAYOUT_MASTER_PERCENT 55       // Master window share of the width
+
+// Event loop
+#define MOTION_REFRESH_RATE 60 // Window drag updates per second
+
+// Logging
+#define DEFAULT_LOG_LEVEL LOG_INFO // Most verbose level written
 
 #endif /* CONFIG_H */
\ No newline at end of file
@@ -1,16 +1,32 @@
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include <xcb/xcb.h>
 
 #include "ipc.h"
 #include "utils.h"
+#include "xreq.h"
+
+const struct Command commands[COMMAND_COUNT] = {
+#define COMMAND_ENTRY(id, name, atom, args, handler) { name, atom, args },
+  WM_COMMANDS(COMMAND_ENTRY)
+#undef COMMAND_ENTRY
+};
+
+static xcb_intern_atom_cookie_t
+intern_atom(xcb_connection_t* conn, const char* name)
+{
+  return xreq_intern_atom(conn, 0, strlen(name), name);
+}
 
 static xcb_atom_t
-init_atom(xcb_connection_t* conn, const char* name)
+intern_atom_reply(xcb_connection_t* conn, xcb_intern_atom_cookie_t cookie)
 {
-  xcb_intern_atom_cookie_t cookie =
-    xcb_intern_atom(conn, 0, strlen(name), name);
-  xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply(conn, cookie, NULL);
+  xcb_intern_atom_reply_t* reply = xreq_intern_atom_reply(conn, cookie, NULL);
 
   if (!reply)
     die("Failed to create atom");
@@ -21,74 +37,299 @@ init_atom(xcb_connection_t* conn, const char* name)
   return atom;
 }
 
-xcb_atom_t
-init_kill_command_atom(xcb_connection_t* conn)
+int
+find_command(const char* name)
 {
-  return init_atom(conn, WM_COMMAND_KILL);
+  for (int i = 0; i < COMMAND_COUNT; i++) {
+    if (strcmp(name, commands[i].name) == 0)
+      return i;
+  }
+  return -1;
 }
 
-xcb_atom_t
-init_move_command_atom(xcb_connection_t* conn)
+void
+init_command_atoms(xcb_connection_t* conn,
+                   const bool* wanted,
+                   xcb_atom_t atoms[COMMAND_COUNT])
 {
-  return init_atom(conn, WM_COMMAND_MOVE);
+  xcb_intern_atom_cookie_t cookies[COMMAND_COUNT];
+
+  // Send every request first so all replies arrive in one round trip
+  for (int i = 0; i < COMMAND_COUNT; i++) {
+    if (!wanted || wanted[i])
+      cookies[i] = intern_atom(conn, commands[i].atom_name);
+  }
+
+  for (int i = 0; i < COMMAND_COUNT; i++) {
+    if (!wanted || wanted[i])
+      atoms[i] = intern_atom_reply(conn, cookies[i]);
+  }
 }
 
 xcb_atom_t
-init_resize_command_atom(xcb_connection_t* conn)
+init_command_atom(xcb_connection_t* conn, enum CommandId id)
 {
-  return init_atom(conn, WM_COMMAND_RESIZE);
+  return intern_atom_reply(conn, intern_atom(conn, commands[id].atom_name));
 }
 
-xcb_atom_t
-init_focus_next_command_atom(xcb_connection_t* conn)
+const char*
+ipc_status_string(int status)
 {
-  return init_atom(conn, WM_COMMAND_FOCUS_NEXT);
+  switch (status) {
+    case IPC_OK:
+      return "Success";
+    case IPC_ERR_UNKNOWN_COMMAND:
+      return "Unknown command";
+    case IPC_ERR_ARGUMENTS:
+      return "Wrong number of arguments";
+    case IPC_ERR_NO_WINDOW:
+      return "No focused window";
+    case IPC_ERR_WORKSPACE:
+      return "Invalid workspace";
+    case IPC_ERR_LAYOUT:
+      return "Invalid layout";
+    case IPC_ERR_OUTPUT:
+      return "Invalid output";
+    default:
+      return "Command failed";
+  }
 }
 
-xcb_atom_t
-init_focus_prev_command_atom(xcb_connection_t* conn)
+void
+ipc_socket_path(char* buf, size_t size)
 {
-  return init_atom(conn, WM_COMMAND_FOCUS_PREV);
+  const char* path = getenv("WM_SOCKET");
+  if (path && *path) {
+    snprintf(buf, size, "%s", path);
+    return;
+  }
+
+  // One socket per display, keeping only the display number characters
+  const char* display = getenv("DISPLAY");
+  char name[32] = "";
+  size_t n = 0;
+  for (; display && *display && n < sizeof(name) - 1; display++) {
+    if ((*display >= '0' && *display <= '9') || *display == '.')
+      name[n++] = *display;
+  }
+  name[n] = '\0';
+
+  const char* dir = getenv("XDG_RUNTIME_DIR");
+  if (dir && *dir)
+    snprintf(buf, size, "%s/wm-%s.sock", dir, name);
+  else
+    snprintf(buf, size, "/tmp/wm-%d-%s.sock", (int)getuid(), name);
 }
 
-xcb_atom_t
-init_snap_left_command_atom(xcb_connection_t* conn)
+void
+ipc_query_socket_path(char* buf, size_t size)
 {
-  return init_atom(conn, WM_COMMAND_SNAP_LEFT);
+  char path[108];
+  ipc_socket_path(path, sizeof(path));
+
+  size_t len = strlen(path);
+  if (len > 5 && strcmp(path + len - 5, ".sock") == 0)
+    snprintf(buf, size, "%.*s.query.sock", (int)(len - 5), path);
+  else
+    snprintf(buf, size, "%s.query", path);
 }
 
-xcb_atom_t
-init_snap_right_command_atom(xcb_connection_t* conn)
+static int
+connect_path(const char* path)
 {
-  return init_atom(conn, WM_COMMAND_SNAP_RIGHT);
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
 }
 
-xcb_atom_t
-init_maximize_command_atom(xcb_connection_t* conn)
+int
+ipc_connect(void)
 {
-  return init_atom(conn, WM_COMMAND_MAXIMIZE);
+  char path[108];
+  ipc_socket_path(path, sizeof(path));
+  return connect_path(path);
 }
 
-xcb_atom_t
-init_fullscreen_command_atom(xcb_connection_t* conn)
+int
+ipc_connect_query(void)
 {
-  return init_atom(conn, WM_COMMAND_FULLSCREEN);
+  char path[108];
+  ipc_query_socket_path(path, sizeof(path));
+  return connect_path(path);
 }
 
-xcb_atom_t
-init_switch_workspace_command_atom(xcb_connection_t* conn)
+int
+find_query(const char* name)
+{
+  static const char* names[IPC_QUERY_COUNT] = {
+    [IPC_QUERY_LIST_WINDOWS] = "list-windows",
+    [IPC_QUERY_GET_STATE] = "get-state",
+  };
+
+  for (int i = 0; i < IPC_QUERY_COUNT; i++) {
+    if (strcmp(name, names[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static int
+write_all(int fd, const void* buf, size_t len)
 {
-  return init_atom(conn, WM_COMMAND_SWITCH_WORKSPACE);
+  const char* p = buf;
+  while (len) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
 }
 
-xcb_atom_t
-init_send_to_workspace_command_atom(xcb_connection_t* conn)
+static int
+read_all(int fd, void* buf, size_t len)
 {
-  return init_atom(conn, WM_COMMAND_SEND_TO_WORKSPACE);
+  char* p = buf;
+  while (len) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
 }
 
-xcb_atom_t
-init_quit_command_atom(xcb_connection_t* conn)
+int
+ipc_send_request(int fd, int command, const int32_t* args, int arg_count)
 {
-  return init_atom(conn, WM_COMMAND_QUIT);
-}
\ No newline at end of file
+  uint8_t msg[8 + 4 * IPC_MAX_ARGS];
+  uint32_t length = 4 + 4 * arg_count;
+  uint16_t cmd = command;
+  uint16_t count = arg_count;
+
+  if (arg_count < 0 || arg_count > IPC_MAX_ARGS)
+    return -1;
+
+  memcpy(msg, &length, 4);
+  memcpy(msg + 4, &cmd, 2);
+  memcpy(msg + 6, &count, 2);
+  if (arg_count)
+    memcpy(msg + 8, args, 4 * arg_count);
+
+  return write_all(fd, msg, 4 + length);
+}
+
+int
+ipc_read_reply(int fd, int* status, char* text, size_t size)
+{
+  uint32_t length;
+  int32_t st;
+
+  if (read_all(fd, &length, 4) < 0 || length < 4 || length > IPC_MAX_MESSAGE ||
+      read_all(fd, &st, 4) < 0)
+    return -1;
+
+  // Keep what fits and drain the rest
+  size_t text_len = length - 4;
+  size_t keep = text_len < size ? text_len : size - 1;
+  if (read_all(fd, text, keep) < 0)
+    return -1;
+  text[keep] = '\0';
+
+  char discard[256];
+  for (size_t left = text_len - keep; left;) {
+    size_t chunk = left < sizeof(discard) ? left : sizeof(discard);
+    if (read_all(fd, discard, chunk) < 0)
+      return -1;
+    left -= chunk;
+  }
+
+  *status = st;
+  return 0;
+}
+
+char*
+ipc_read_reply_alloc(int fd, int* status)
+{
+  uint32_t length;
+  int32_t st;
+
+  if (read_all(fd, &length, 4) < 0 || length < 4 ||
+      length > IPC_MAX_QUERY_REPLY || read_all(fd, &st, 4) < 0)
+    return NULL;
+
+  char* text = malloc(length - 4 + 1);
+  if (!text)
+    return NULL;
+
+  if (read_all(fd, text, length - 4) < 0) {
+    free(text);
+    return NULL;
+  }
+  text[length - 4] = '\0';
+
+  *status = st;
+  return text;
+}
+
+int
+ipc_read_event(int fd, struct IpcEvent* ev)
+{
+  uint32_t length;
+
+  if (read_all(fd, &length, 4) < 0 || length != sizeof(*ev) ||
+      read_all(fd, ev, sizeof(*ev)) < 0)
+    return -1;
+
+  return 0;
+}
+
+const char*
+ipc_event_name(int type)
+{
+  static const char* names[IPC_EVENT_COUNT] = {
+    [IPC_EVENT_FOCUS] = "focus",   [IPC_EVENT_WORKSPACE] = "workspace",
+    [IPC_EVENT_MAP] = "map",       [IPC_EVENT_DESTROY] = "destroy",
+    [IPC_EVENT_SEND] = "send",     [IPC_EVENT_STATE] = "state",
+    [IPC_EVENT_DROPPED] = "dropped",
+  };
+
+  if (type < 0 || type >= IPC_EVENT_COUNT)
+    return "unknown";
+  return names[type];
+}
+
+const char*
+ipc_state_name(int state)
+{
+  switch (state) {
+    case STATE_NORMAL:
+      return "normal";
+    case STATE_FULLSCREEN:
+      return "fullscreen";
+    case STATE_SNAPPED_LEFT:
+      return "snapped-left";
+    case STATE_SNAPPED_RIGHT:
+      return "snapped-right";
+    case STATE_MAXIMIZED:
+      return "maximized";
+    default:
+      return "unknown";
+  }
+}
@@ -1,46 +1,207 @@
 #ifndef IPC_H
 #define IPC_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <xcb/xcb.h>
 
-// Command atoms
-#define WM_COMMAND_KILL "_WM_COMMAND_KILL"
-#define WM_COMMAND_MOVE "_WM_COMMAND_MOVE"
-#define WM_COMMAND_RESIZE "_WM_COMMAND_RESIZE"
-#define WM_COMMAND_FOCUS_NEXT "_WM_COMMAND_FOCUS_NEXT"
-#define WM_COMMAND_FOCUS_PREV "_WM_COMMAND_FOCUS_PREV"
-#define WM_COMMAND_SNAP_LEFT "_WM_COMMAND_SNAP_LEFT"
-#define WM_COMMAND_SNAP_RIGHT "_WM_COMMAND_SNAP_RIGHT"
-#define WM_COMMAND_MAXIMIZE "_WM_COMMAND_MAXIMIZE"
-#define WM_COMMAND_FULLSCREEN "_WM_COMMAND_FULLSCREEN"
-#define WM_COMMAND_SWITCH_WORKSPACE "_WM_COMMAND_SWITCH_WORKSPACE"
-#define WM_COMMAND_SEND_TO_WORKSPACE "_WM_COMMAND_SEND_TO_WORKSPACE"
-#define WM_COMMAND_QUIT "_WM_COMMAND_QUIT"
-
-// Initialize window manager command atoms
-xcb_atom_t
-init_kill_command_atom(xcb_connection_t* conn);
-xcb_atom_t
-init_move_command_atom(xcb_connection_t* conn);
-xcb_atom_t
-init_resize_command_atom(xcb_connection_t* conn);
-xcb_atom_t
-init_focus_next_command_atom(xcb_connection_t* conn);
-xcb_atom_t
-init_focus_prev_command_atom(xcb_connection_t* conn);
-xcb_atom_t
-init_snap_left_command_atom(xcb_connection_t* conn);
-xcb_atom_t
-init_snap_right_command_atom(xcb_connection_t* conn);
-xcb_atom_t
-init_maximize_command_atom(xcb_connection_t* conn);
-xcb_atom_t
-init_fullscreen_command_atom(xcb_connection_t* conn);
-xcb_atom_t
-init_switch_workspace_command_atom(xcb_connection_t* conn);
-xcb_atom_t
-init_send_to_workspace_command_atom(xcb_connection_t* conn);
+// Window manager commands, one entry per command:
+// X(id, wmc command name, atom name, argument count, wm handler)
+// The position is the id on the wire, so new commands go at the end.
+#define WM_COMMANDS(X)                                                         \
+  X(KILL, "kill-window", "_WM_COMMAND_KILL", 0, handle_kill_window)            \
+  X(MOVE, "move-window", "_WM_COMMAND_MOVE", 2, handle_move_window)            \
+  X(RESIZE, "resize-window", "_WM_COMMAND_RESIZE", 2, handle_resize_window)    \
+  X(FOCUS_NEXT, "focus-next", "_WM_COMMAND_FOCUS_NEXT", 0, handle_focus_next)  \
+  X(FOCUS_PREV, "focus-prev", "_WM_COMMAND_FOCUS_PREV", 0, handle_focus_prev)  \
+  X(SNAP_LEFT,                                                                 \
+    "toggle-snap-left",                                                        \
+    "_WM_COMMAND_SNAP_LEFT",                                                   \
+    0,                                                                         \
+    handle_toggle_snap_left)                                                   \
+  X(SNAP_RIGHT,                                                                \
+    "toggle-snap-right",                                                       \
+    "_WM_COMMAND_SNAP_RIGHT",                                                  \
+    0,                                                                         \
+    handle_toggle_snap_right)                                                  \
+  X(MAXIMIZE,                                                                  \
+    "toggle-maximize",                                                         \
+    "_WM_COMMAND_MAXIMIZE",                                                    \
+    0,                                                                         \
+    handle_toggle_maximize)                                                    \
+  X(FULLSCREEN,                                                                \
+    "toggle-fullscreen",                                                       \
+    "_WM_COMMAND_FULLSCREEN",                                                  \
+    0,                                                                         \
+    handle_toggle_fullscreen)                                                  \
+  X(SWITCH_WORKSPACE,                                                          \
+    "switch-to-workspace",                                                     \
+    "_WM_COMMAND_SWITCH_WORKSPACE",                                            \
+    1,                                                                         \
+    handle_switch_workspace)                                                   \
+  X(SEND_TO_WORKSPACE,                                                         \
+    "send-to-workspace",                                                       \
+    "_WM_COMMAND_SEND_TO_WORKSPACE",                                           \
+    1,                                                                         \
+    handle_send_to_workspace)                                                  \
+  X(RESTART, "restart", "_WM_COMMAND_RESTART", 0, handle_restart)              \
+  X(QUIT, "quit", "_WM_COMMAND_QUIT", 0, handle_quit)                          \
+  X(LAYOUT, "set-layout", "_WM_COMMAND_LAYOUT", 1, handle_set_layout)          \
+  X(FOCUS_OUTPUT,                                                              \
+    "focus-output",                                                            \
+    "_WM_COMMAND_FOCUS_OUTPUT",                                                \
+    1,                                                                         \
+    handle_focus_output)                                                       \
+  X(RESET_STATS,                                                               \
+    "reset-stats",                                                             \
+    "_WM_COMMAND_RESET_STATS",                                                 \
+    0,                                                                         \
+    handle_reset_stats)
+
+enum CommandId
+{
+#define COMMAND_ID(id, name, atom, args, handler) COMMAND_##id,
+  WM_COMMANDS(COMMAND_ID)
+#undef COMMAND_ID
+    COMMAND_COUNT
+};
+
+struct Command
+{
+  const char* name;      // Name used on the wmc command line
+  const char* atom_name; // Atom used as the client message type
+  int arg_count;         // Number of 32-bit arguments
+};
+
+extern const struct Command commands[COMMAND_COUNT];
+
+// Unix socket protocol. Every message is a native endian uint32 body
+// length followed by the body. Command ids are indexes into commands[].
+//   Request body: uint16 command, uint16 argument count, int32 arguments
+//   Reply body:   int32 status, optional text
+#define IPC_MAX_ARGS 5 // Same as a 32-bit client message
+#define IPC_MAX_MESSAGE 4096
+#define IPC_MAX_QUERY_REPLY (64 << 20)
+
+// Read-only queries are served on a separate socket from a snapshot of
+// the window list. Requests use the command format with a query id.
+enum IpcQuery
+{
+  IPC_QUERY_LIST_WINDOWS,
+  IPC_QUERY_GET_STATE,
+  IPC_QUERY_COUNT
+};
+
+// Request id that turns the connection into an event stream. Each event
+// is then sent as a message whose body is a struct IpcEvent.
+#define IPC_SUBSCRIBE 0xffff
+
+// Request id answered with the latency histograms as text, one
+// histogram per line
+#define IPC_STATS 0xfffe
+
+enum IpcEventType
+{
+  IPC_EVENT_FOCUS,     // window gained focus, 0 if none
+  IPC_EVENT_WORKSPACE, // workspace is now shown, value is the previous one
+  IPC_EVENT_MAP,       // window was framed on workspace
+  IPC_EVENT_DESTROY,   // window was destroyed
+  IPC_EVENT_SEND,      // window was sent to workspace
+  IPC_EVENT_STATE,     // window changed to state value
+  IPC_EVENT_DROPPED,   // value events were dropped, the subscriber was slow
+  IPC_EVENT_COUNT
+};
+
+struct IpcEvent
+{
+  uint16_t type;
+  uint16_t workspace;
+  uint32_t window; // Client window id
+  uint32_t value;
+};
+
+enum WindowState
+{
+  STATE_NORMAL,
+  STATE_FULLSCREEN,
+  STATE_SNAPPED_LEFT,
+  STATE_SNAPPED_RIGHT,
+  STATE_MAXIMIZED
+};
+
+enum IpcStatus
+{
+  IPC_OK,
+  IPC_ERR_UNKNOWN_COMMAND,
+  IPC_ERR_ARGUMENTS,
+  IPC_ERR_NO_WINDOW,
+  IPC_ERR_WORKSPACE,
+  IPC_ERR_FAILED,
+  IPC_ERR_LAYOUT,
+  IPC_ERR_OUTPUT,
+};
+
+// Describe a status code
+const char*
+ipc_status_string(int status);
+
+// Write the command socket path for the current display
+void
+ipc_socket_path(char* buf, size_t size);
+
+// Write the query socket path for the current display
+void
+ipc_query_socket_path(char* buf, size_t size);
+
+// Connect to the command socket, returns -1 if wm is not listening
+int
+ipc_connect(void);
+
+// Connect to the query socket, returns -1 if wm is not listening
+int
+ipc_connect_query(void);
+
+// Find a query by its wmc name, returns -1 if unknown
+int
+find_query(const char* name);
+
+// Send one request, returns 0 on success
+int
+ipc_send_request(int fd, int command, const int32_t* args, int arg_count);
+
+// Read one reply, the text is NUL terminated. Returns 0 on success.
+int
+ipc_read_reply(int fd, int* status, char* text, size_t size);
+
+// Read one reply of any size up to IPC_MAX_QUERY_REPLY. The returned text
+// is NUL terminated and must be freed, NULL on failure.
+char*
+ipc_read_reply_alloc(int fd, int* status);
+
+// Read one event from a subscribed connection, returns 0 on success
+int
+ipc_read_event(int fd, struct IpcEvent* ev);
+
+// Describe an event type or window state
+const char*
+ipc_event_name(int type);
+const char*
+ipc_state_name(int state);
+
+// Find a command by its wmc name, returns -1 if unknown
+int
+find_command(const char* name);
+
+// Initialize the command atoms in wanted, or all of them if wanted is
+// NULL, pipelining the intern requests
+void
+init_command_atoms(xcb_connection_t* conn,
+                   const bool* wanted,
+                   xcb_atom_t atoms[COMMAND_COUNT]);
+
+// Initialize a single command atom
 xcb_atom_t
-init_quit_command_atom(xcb_connection_t* conn);
+init_command_atom(xcb_connection_t* conn, enum CommandId id);
 
 #endif /* IPC_H */
@@ -0,0 +1,80 @@
+#include "layout.h"
+#include "settings.h"
+
+// Split length into parts, handing the remainder to the first ones so the
+// pieces always cover it exactly
+static void
+split(int16_t start,
+      uint16_t length,
+      int parts,
+      int index,
+      int16_t* pos,
+      uint16_t* size)
+{
+  int base = length / parts;
+  int extra = length % parts;
+
+  *pos = start + index * base + (index < extra ? index : extra);
+  *size = base + (index < extra ? 1 : 0);
+}
+
+static void
+arrange_master_stack(int count, struct Rect area, struct Rect* rects)
+{
+  if (count == 1) {
+    rects[0] = area;
+    return;
+  }
+
+  uint16_t master_width = area.width * settings.master_percent / 100;
+  rects[0] = (struct Rect){ area.x, area.y, master_width, area.height };
+
+  for (int i = 1; i < count; i++) {
+    rects[i].x = area.x + master_width;
+    rects[i].width = area.width - master_width;
+    split(area.y, area.height, count - 1, i - 1, &rects[i].y, &rects[i].height);
+  }
+}
+
+static void
+arrange_grid(int count, struct Rect area, struct Rect* rects)
+{
+  int cols = 1;
+  while (cols * cols < count)
+    cols++;
+  int rows = (count + cols - 1) / cols;
+
+  for (int i = 0; i < count; i++) {
+    int row = i / cols;
+    // The last row stretches its windows over the full width
+    int in_row = row == rows - 1 ? count - row * cols : cols;
+
+    split(area.x, area.width, in_row, i % cols, &rects[i].x, &rects[i].width);
+    split(area.y, area.height, rows, row, &rects[i].y, &rects[i].height);
+  }
+}
+
+void
+layout_arrange(enum Layout layout,
+               int count,
+               struct Rect area,
+               struct Rect* rects)
+{
+  if (count <= 0)
+    return;
+
+  switch (layout) {
+    case LAYOUT_MASTER_STACK:
+      arrange_master_stack(count, area, rects);
+      break;
+    case LAYOUT_GRID:
+      arrange_grid(count, area, rects);
+      break;
+    case LAYOUT_MONOCLE:
+      for (int i = 0; i < count; i++)
+        rects[i] = area;
+      break;
+    default:
+      break;
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdint.h>
+
+enum Layout
+{
+  LAYOUT_FLOATING, // Windows keep the geometry they are given
+  LAYOUT_MASTER_STACK,
+  LAYOUT_GRID,
+  LAYOUT_MONOCLE,
+  LAYOUT_COUNT
+};
+
+struct Rect
+{
+  int16_t x, y;
+  uint16_t width, height;
+};
+
+// Compute the rectangles of count tiled windows within area. Does nothing
+// for LAYOUT_FLOATING.
+void
+layout_arrange(enum Layout layout,
+               int count,
+               struct Rect area,
+               struct Rect* rects);
+
+#endif /* LAYOUT_H */
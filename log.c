@@ -0,0 +1,237 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+#define LOG_SLOTS 4096        // Ring size, a power of two
+#define LOG_MESSAGE 240       // Longer messages are truncated
+#define LOG_WRITE_INTERVAL 20 // Milliseconds between writer passes
+#define LOG_BUFFER (64 << 10) // Bytes per write
+
+atomic_int log_level = LOG_INFO;
+
+static const char* level_names[LOG_LEVEL_COUNT] = { "error",
+                                                    "warn",
+                                                    "info",
+                                                    "debug" };
+
+// Slot of the ring. A producer owns it while sequence equals the claimed
+// position and publishes it by storing position + 1, the writer hands it
+// back for the next lap by storing position + LOG_SLOTS.
+struct LogRecord
+{
+  atomic_size_t sequence;
+  uint64_t time; // Monotonic nanoseconds
+  int level;
+  char message[LOG_MESSAGE];
+};
+
+static struct LogRecord ring[LOG_SLOTS];
+static atomic_size_t head;   // Next position producers claim
+static size_t tail;          // Next position the writer reads
+static atomic_ulong dropped; // Records lost to a full ring
+static atomic_bool running;
+static pthread_t writer;
+static int64_t clock_offset; // Wall clock minus monotonic clock (ns)
+
+int
+log_level_from_name(const char* name)
+{
+  for (int i = 0; i < LOG_LEVEL_COUNT; i++) {
+    if (strcmp(level_names[i], name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Append "[HH:MM:SS.mmm] level: message" to out, reusing the formatted
+// seconds while they do not change
+static size_t
+format_line(char* out,
+            size_t size,
+            uint64_t time,
+            int level,
+            const char* message)
+{
+  static _Thread_local time_t cached_second = -1;
+  static _Thread_local char cached[16];
+
+  uint64_t wall = time + clock_offset;
+  time_t second = wall / 1000000000ull;
+  if (second != cached_second) {
+    struct tm tm;
+    localtime_r(&second, &tm);
+    strftime(cached, sizeof(cached), "%H:%M:%S", &tm);
+    cached_second = second;
+  }
+
+  int n = snprintf(out,
+                   size,
+                   "[%s.%03d] %s: %s\n",
+                   cached,
+                   (int)(wall / 1000000 % 1000),
+                   level_names[level],
+                   message);
+  return n < 0 ? 0 : (size_t)n < size ? (size_t)n : size - 1;
+}
+
+static void
+write_all(const char* buf, size_t len)
+{
+  while (len) {
+    ssize_t n = write(STDERR_FILENO, buf, len);
+    if (n <= 0)
+      return;
+    buf += n;
+    len -= n;
+  }
+}
+
+static void
+clock_init(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t realtime = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  clock_offset = (int64_t)(realtime - now_ns());
+}
+
+void
+log_write(enum LogLevel level, const char* fmt, ...)
+{
+  va_list ap;
+
+  if (!atomic_load_explicit(&running, memory_order_acquire)) {
+    char message[LOG_MESSAGE];
+    char line[LOG_MESSAGE + 64];
+
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+
+    // Only this thread logs while there is no writer
+    if (!clock_offset)
+      clock_init();
+    write_all(line, format_line(line, sizeof(line), now_ns(), level, message));
+    return;
+  }
+
+  size_t pos = atomic_load_explicit(&head, memory_order_relaxed);
+  struct LogRecord* r;
+  for (;;) {
+    r = &ring[pos & (LOG_SLOTS - 1)];
+    size_t seq = atomic_load_explicit(&r->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if (diff == 0 &&
+        atomic_compare_exchange_weak_explicit(
+          &head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+      break;
+
+    // The writer is a lap behind, drop rather than wait
+    if (diff < 0) {
+      atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+      return;
+    }
+
+    if (diff > 0)
+      pos = atomic_load_explicit(&head, memory_order_relaxed);
+  }
+
+  r->time = now_ns();
+  r->level = level;
+  va_start(ap, fmt);
+  vsnprintf(r->message, sizeof(r->message), fmt, ap);
+  va_end(ap);
+
+  atomic_store_explicit(&r->sequence, pos + 1, memory_order_release);
+}
+
+// Write out every published record, one write per full buffer
+static void
+drain(void)
+{
+  static char buf[LOG_BUFFER];
+  size_t len = 0;
+
+  for (;;) {
+    struct LogRecord* r = &ring[tail & (LOG_SLOTS - 1)];
+    size_t seq = atomic_load_explicit(&r->sequence, memory_order_acquire);
+    if (seq != tail + 1)
+      break;
+
+    if (LOG_BUFFER - len < LOG_MESSAGE + 64) {
+      write_all(buf, len);
+      len = 0;
+    }
+    len += format_line(
+      buf + len, LOG_BUFFER - len, r->time, r->level, r->message);
+
+    atomic_store_explicit(&r->sequence, tail + LOG_SLOTS, memory_order_release);
+    tail++;
+  }
+
+  unsigned long lost =
+    atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+  if (lost) {
+    char message[64];
+    snprintf(message, sizeof(message), "dropped %lu log records", lost);
+    if (LOG_BUFFER - len < sizeof(message) + 64) {
+      write_all(buf, len);
+      len = 0;
+    }
+    len += format_line(
+      buf + len, LOG_BUFFER - len, now_ns(), LOG_WARN, message);
+  }
+
+  write_all(buf, len);
+}
+
+static void*
+writer_main(void* arg)
+{
+  (void)arg;
+
+  struct timespec interval = { 0, LOG_WRITE_INTERVAL * 1000000L };
+  while (atomic_load_explicit(&running, memory_order_acquire)) {
+    drain();
+    nanosleep(&interval, NULL);
+  }
+
+  // Records published before running was cleared
+  drain();
+  return NULL;
+}
+
+void
+log_start(void)
+{
+  if (atomic_load(&running))
+    return;
+
+  clock_init();
+  for (size_t i = 0; i < LOG_SLOTS; i++)
+    atomic_store(&ring[i].sequence, i);
+  atomic_store(&head, 0);
+  tail = 0;
+
+  atomic_store(&running, true);
+  if (pthread_create(&writer, NULL, writer_main, NULL) != 0)
+    atomic_store(&running, false);
+}
+
+void
+log_stop(void)
+{
+  if (!atomic_exchange(&running, false))
+    return;
+
+  pthread_join(writer, NULL);
+}
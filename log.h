@@ -0,0 +1,56 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdatomic.h>
+
+enum LogLevel
+{
+  LOG_ERROR,
+  LOG_WARN,
+  LOG_INFO,
+  LOG_DEBUG,
+  LOG_LEVEL_COUNT
+};
+
+// Levels above this are compiled out, e.g. -DLOG_MAX_LEVEL=LOG_INFO
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_DEBUG
+#endif
+
+// Most verbose level written, chosen at runtime
+extern atomic_int log_level;
+
+#define LOG(level, ...)                                                        \
+  do {                                                                         \
+    if ((level) <= LOG_MAX_LEVEL &&                                            \
+        (int)(level) <=                                                        \
+          atomic_load_explicit(&log_level, memory_order_relaxed))              \
+      log_write((level), __VA_ARGS__);                                         \
+  } while (0)
+
+#define log_error(...) LOG(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) LOG(LOG_WARN, __VA_ARGS__)
+#define log_info(...) LOG(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) LOG(LOG_DEBUG, __VA_ARGS__)
+
+// Format a record. Once log_start() ran it is queued for the writer
+// thread without blocking or making system calls, before that it is
+// written to stderr right away.
+void
+log_write(enum LogLevel level, const char* fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+// Level for a name such as "debug", -1 if unknown
+int
+log_level_from_name(const char* name);
+
+// Start the background writer
+void
+log_start(void);
+
+// Write out everything queued and stop the writer, logging becomes
+// synchronous again
+void
+log_stop(void);
+
+#endif /* LOG_H */
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+#include "wm.h"
+#include "xreq.h"
+
+// A replay reports how long it took and what the handlers cost, so
+// builds can be compared on the same trace
+static void
+print_replay_stats(uint64_t elapsed)
+{
+  char* text = stats_report();
+  printf("replay_ns=%llu\n%s", (unsigned long long)elapsed, text ? text : "");
+  free(text);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int restore_fd = -1;
+  const char* trace_path = NULL;
+  const char* replay_path = NULL;
+
+  // Every option takes a value
+  for (int i = 1; i < argc; i += 2) {
+    const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (value && strcmp(argv[i], "--restore") == 0)
+      restore_fd = atoi(value);
+    else if (value && strcmp(argv[i], "--trace") == 0)
+      trace_path = value;
+    else if (value && strcmp(argv[i], "--replay") == 0)
+      replay_path = value;
+    else
+      die("Usage: wm [--trace FILE | --replay FILE]");
+  }
+
+  log_start();
+  if (replay_path) {
+    if (!trace_replay(replay_path))
+      die("Failed to replay %s", replay_path);
+    xreq_use(&xreq_replay);
+  } else if (trace_path && !trace_record(trace_path)) {
+    die("Failed to record %s", trace_path);
+  }
+
+  uint64_t start = now_ns();
+  struct StatsScope scope = stats_phase(STATS_SETUP);
+  wm_setup(argv[0], restore_fd);
+  stats_end(scope);
+
+  // Replays keep off the sockets of a running wm
+  if (trace_mode != TRACE_REPLAY)
+    wm_listen();
+  wm_run();
+  if (trace_mode == TRACE_REPLAY)
+    print_replay_stats(now_ns() - start);
+
+  wm_shutdown();
+  trace_close();
+  log_stop();
+  return 0;
+}
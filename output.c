@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+#include <xcb/xcb.h>
+#ifdef HAVE_RANDR
+#include <xcb/randr.h>
+#endif
+
+#include "log.h"
+#include "output.h"
+#include "xreq.h"
+
+static xcb_connection_t* conn;
+static xcb_screen_t* screen;
+static struct Rect outputs[OUTPUT_MAX];
+static int count;
+static bool stale; // A screen change arrived since the last query
+
+#ifdef HAVE_RANDR
+static uint8_t randr_event_base;
+static bool randr_monitors; // Server speaks RandR 1.5
+
+// Monitors are logical outputs, clones share one
+static int
+query_monitors(struct Rect* rects)
+{
+  xcb_randr_get_monitors_reply_t* reply = xreq_randr_get_monitors_reply(
+    conn, xreq_randr_get_monitors(conn, screen->root, 1), NULL);
+  if (!reply)
+    return 0;
+
+  int n = 0;
+  xcb_randr_monitor_info_iterator_t it =
+    xcb_randr_get_monitors_monitors_iterator(reply);
+  for (; it.rem && n < OUTPUT_MAX; xcb_randr_monitor_info_next(&it)) {
+    struct Rect r = {
+      it.data->x, it.data->y, it.data->width, it.data->height
+    };
+
+    // Keep the primary monitor first
+    if (it.data->primary && n) {
+      rects[n++] = rects[0];
+      rects[0] = r;
+    } else {
+      rects[n++] = r;
+    }
+  }
+
+  free(reply);
+  return n;
+}
+#endif
+
+static int
+query_outputs(struct Rect* rects)
+{
+#ifdef HAVE_RANDR
+  if (randr_monitors) {
+    int n = query_monitors(rects);
+    if (n)
+      return n;
+  }
+#endif
+
+  rects[0] =
+    (struct Rect){ 0, 0, screen->width_in_pixels, screen->height_in_pixels };
+  return 1;
+}
+
+void
+output_init(xcb_connection_t* c, xcb_screen_t* s)
+{
+  conn = c;
+  screen = s;
+
+#ifdef HAVE_RANDR
+  const xcb_query_extension_reply_t* ext =
+    xreq_get_extension_data(conn, &xcb_randr_id);
+  if (ext && ext->present) {
+    xcb_randr_query_version_reply_t* version = xreq_randr_query_version_reply(
+      conn, xreq_randr_query_version(conn, 1, 5), NULL);
+    if (version) {
+      randr_monitors = version->major_version > 1 ||
+                       (version->major_version == 1 &&
+                        version->minor_version >= 5);
+      free(version);
+    }
+
+    randr_event_base = ext->first_event;
+    xreq_randr_select_input(
+      conn, screen->root, XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE);
+  }
+
+  if (!randr_monitors)
+    log_info("RandR 1.5 not available, using the whole screen");
+#endif
+
+  count = query_outputs(outputs);
+  stale = false;
+  log_info("Found %d outputs", count);
+}
+
+bool
+output_handle_event(const xcb_generic_event_t* ev)
+{
+#ifdef HAVE_RANDR
+  if (randr_event_base &&
+      (ev->response_type & ~0x80) ==
+        randr_event_base + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
+    // The root window follows the combined size of the outputs
+    const xcb_randr_screen_change_notify_event_t* sc =
+      (const xcb_randr_screen_change_notify_event_t*)ev;
+    screen->width_in_pixels = sc->width;
+    screen->height_in_pixels = sc->height;
+
+    stale = true;
+    return true;
+  }
+#else
+  (void)ev;
+#endif
+
+  return false;
+}
+
+bool
+output_refresh(void)
+{
+  if (!stale)
+    return false;
+  stale = false;
+
+  struct Rect rects[OUTPUT_MAX];
+  int n = query_outputs(rects);
+  if (n == count && memcmp(rects, outputs, sizeof(struct Rect) * n) == 0)
+    return false;
+
+  memcpy(outputs, rects, sizeof(struct Rect) * n);
+  count = n;
+  log_info("Outputs changed, now %d", count);
+  return true;
+}
+
+int
+output_count(void)
+{
+  return count;
+}
+
+struct Rect
+output_area(int index)
+{
+  return outputs[index];
+}
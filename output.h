@@ -0,0 +1,35 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <xcb/xcb.h>
+
+#include "config.h"
+#include "layout.h"
+
+// Every output shows a workspace, so there can be no more of them
+#define OUTPUT_MAX MAX_WORKSPACES
+
+// Discover the outputs of screen and watch for changes. Without RandR the
+// whole screen is a single output.
+void
+output_init(xcb_connection_t* conn, xcb_screen_t* screen);
+
+// Note a screen change if ev is one, returns whether it was consumed
+bool
+output_handle_event(const xcb_generic_event_t* ev);
+
+// Query the outputs again after a screen change, once per batch. Returns
+// whether the output list changed.
+bool
+output_refresh(void);
+
+// Number of cached outputs, the primary one first
+int
+output_count(void);
+
+// Area of an output in root coordinates
+struct Rect
+output_area(int index);
+
+#endif /* OUTPUT_H */
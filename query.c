@@ -0,0 +1,440 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "log.h"
+#include "query.h"
+#include "utils.h"
+
+#define QUERY_MAX_CLIENTS 32
+#define QUERY_TIMEOUT_MS 1000 // A client may stall a request or reply this long
+
+struct Buffer
+{
+  char* data;
+  size_t len;
+  size_t cap;
+};
+
+struct QueryClient
+{
+  int fd;             // -1 once closed
+  uint8_t in[8];      // Partial request
+  size_t in_len;
+  struct Buffer text; // Reply text being formatted
+  struct Buffer out;  // Framed reply, the next request waits for it
+  size_t out_sent;
+  uint64_t deadline;  // now_ns() the stalled client is dropped at, or 0
+};
+
+static int listen_fd = -1;
+static int wake_fds[2] = { -1, -1 };
+static char socket_path[108];
+static pthread_t thread;
+static struct QueryClient clients[QUERY_MAX_CLIENTS]; // Query thread only
+static int client_count;
+
+// The mutex only guards taking a reference, never any real work
+static pthread_mutex_t current_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct QuerySnapshot* current;
+
+struct QuerySnapshot*
+query_snapshot_new(int window_count)
+{
+  struct QuerySnapshot* snap =
+    calloc(1, sizeof(*snap) + sizeof(struct QueryWindow) * window_count);
+  if (!snap)
+    return NULL;
+
+  atomic_init(&snap->refs, 1);
+  snap->window_count = window_count;
+  return snap;
+}
+
+static void
+snapshot_release(struct QuerySnapshot* snap)
+{
+  if (snap && atomic_fetch_sub(&snap->refs, 1) == 1)
+    free(snap);
+}
+
+static struct QuerySnapshot*
+snapshot_acquire(void)
+{
+  pthread_mutex_lock(&current_lock);
+  struct QuerySnapshot* snap = current;
+  if (snap)
+    atomic_fetch_add(&snap->refs, 1);
+  pthread_mutex_unlock(&current_lock);
+  return snap;
+}
+
+void
+query_publish(struct QuerySnapshot* snap)
+{
+  static uint64_t generation;
+  snap->generation = ++generation;
+
+  pthread_mutex_lock(&current_lock);
+  struct QuerySnapshot* old = current;
+  current = snap;
+  pthread_mutex_unlock(&current_lock);
+
+  snapshot_release(old);
+}
+
+static void
+buffer_printf(struct Buffer* b, const char* fmt, ...)
+{
+  va_list ap;
+
+  for (;;) {
+    va_start(ap, fmt);
+    int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+      return;
+    if (b->len + n < b->cap) {
+      b->len += n;
+      return;
+    }
+
+    size_t cap = b->cap ? b->cap * 2 : 4096;
+    while (cap <= b->len + n)
+      cap *= 2;
+    char* data = realloc(b->data, cap);
+    if (!data)
+      return;
+    b->data = data;
+    b->cap = cap;
+  }
+}
+
+static void
+format_window(struct Buffer* b, const struct QueryWindow* w)
+{
+  buffer_printf(b,
+                "window=0x%x frame=0x%x workspace=%u x=%d y=%d width=%u "
+                "height=%u state=%s focused=%u\n",
+                w->id,
+                w->frame,
+                w->workspace,
+                w->x,
+                w->y,
+                w->width,
+                w->height,
+                ipc_state_name(w->state),
+                w->focused);
+}
+
+static void
+format_state(struct Buffer* b, const struct QuerySnapshot* snap)
+{
+  uint32_t focused = 0;
+  for (int i = 0; i < snap->window_count; i++) {
+    if (snap->windows[i].focused &&
+        snap->windows[i].workspace == snap->current_workspace)
+      focused = snap->windows[i].id;
+  }
+
+  buffer_printf(b,
+                "generation=%llu workspace=%d windows=%d focused=0x%x\n",
+                (unsigned long long)snap->generation,
+                snap->current_workspace,
+                snap->window_count,
+                focused);
+}
+
+static struct QueryClient*
+client_add(int fd)
+{
+  if (client_count == QUERY_MAX_CLIENTS)
+    return NULL;
+
+  struct QueryClient* c = &clients[client_count++];
+  memset(c, 0, sizeof(*c));
+  c->fd = fd;
+  return c;
+}
+
+static void
+client_close(struct QueryClient* c)
+{
+  close(c->fd);
+  free(c->out.data);
+  free(c->text.data);
+  memset(c, 0, sizeof(*c));
+  c->fd = -1;
+}
+
+// Frame the text as a reply and queue it
+static void
+client_reply(struct QueryClient* c, int status)
+{
+  uint32_t length = 4 + c->text.len;
+  int32_t st = status;
+  size_t size = 8 + c->text.len;
+
+  if (c->out.cap < size) {
+    char* data = realloc(c->out.data, size);
+    if (!data) {
+      client_close(c);
+      return;
+    }
+    c->out.data = data;
+    c->out.cap = size;
+  }
+
+  memcpy(c->out.data, &length, 4);
+  memcpy(c->out.data + 4, &st, 4);
+  memcpy(c->out.data + 8, c->text.data, c->text.len);
+  c->out.len = size;
+  c->out_sent = 0;
+}
+
+// Bytes moved, so a client in the middle of a request or reply gets a
+// fresh deadline. An idle one may wait as long as it likes.
+static void
+client_progress(struct QueryClient* c, uint64_t now)
+{
+  bool busy = c->fd >= 0 && (c->in_len || c->out.len);
+  c->deadline = busy ? now + QUERY_TIMEOUT_MS * 1000000ull : 0;
+}
+
+// Answer the request in the input buffer
+static void
+client_process(struct QueryClient* c)
+{
+  uint32_t length;
+  uint16_t query, arg_count;
+  memcpy(&length, c->in, 4);
+  memcpy(&query, c->in + 4, 2);
+  memcpy(&arg_count, c->in + 6, 2);
+  c->in_len = 0;
+  if (length != 4 || arg_count != 0) {
+    client_close(c);
+    return;
+  }
+
+  c->text.len = 0;
+  int status = IPC_OK;
+  struct QuerySnapshot* snap = snapshot_acquire();
+
+  if (!snap) {
+    status = IPC_ERR_FAILED;
+  } else if (query == IPC_QUERY_LIST_WINDOWS) {
+    for (int i = 0; i < snap->window_count; i++)
+      format_window(&c->text, &snap->windows[i]);
+  } else if (query == IPC_QUERY_GET_STATE) {
+    format_state(&c->text, snap);
+  } else {
+    status = IPC_ERR_UNKNOWN_COMMAND;
+  }
+
+  snapshot_release(snap);
+
+  if (status != IPC_OK)
+    buffer_printf(&c->text, "%s", ipc_status_string(status));
+  client_reply(c, status);
+}
+
+static void
+client_read(struct QueryClient* c, uint64_t now)
+{
+  ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (n <= 0) {
+    client_close(c);
+    return;
+  }
+
+  c->in_len += n;
+  if (c->in_len == sizeof(c->in))
+    client_process(c);
+  client_progress(c, now);
+}
+
+static void
+client_write(struct QueryClient* c, uint64_t now)
+{
+  while (c->out_sent < c->out.len) {
+    ssize_t n = send(c->fd,
+                     c->out.data + c->out_sent,
+                     c->out.len - c->out_sent,
+                     MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      break;
+    if (n <= 0) {
+      client_close(c);
+      return;
+    }
+    c->out_sent += n;
+    client_progress(c, now);
+  }
+
+  if (c->out_sent == c->out.len) {
+    c->out.len = c->out_sent = 0;
+    client_progress(c, now);
+  }
+}
+
+static void
+accept_clients(void)
+{
+  for (;;) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0)
+      return;
+
+    if (!client_add(fd)) {
+      log_warn("Too many query clients");
+      close(fd);
+    }
+  }
+}
+
+// Drop closed clients, keeping the rest in order
+static void
+compact_clients(void)
+{
+  int n = 0;
+  for (int i = 0; i < client_count; i++) {
+    if (clients[i].fd >= 0)
+      clients[n++] = clients[i];
+  }
+  client_count = n;
+}
+
+// Milliseconds until the first stalled client runs out of time
+static int
+next_timeout(uint64_t now)
+{
+  uint64_t first = 0;
+  for (int i = 0; i < client_count; i++) {
+    uint64_t deadline = clients[i].deadline;
+    if (deadline && (!first || deadline < first))
+      first = deadline;
+  }
+
+  if (!first)
+    return -1;
+  return first > now ? (first - now + 999999) / 1000000 : 0;
+}
+
+// Clients are served side by side, each one request at a time: its
+// reply has to be taken before the next request is read
+static void*
+query_thread(void* arg)
+{
+  (void)arg;
+
+  struct pollfd fds[2 + QUERY_MAX_CLIENTS];
+  fds[0] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+  fds[1] = (struct pollfd){ .fd = wake_fds[0], .events = POLLIN };
+
+  for (;;) {
+    int count = client_count;
+    for (int i = 0; i < count; i++) {
+      short events = clients[i].out.len ? POLLOUT : POLLIN;
+      fds[2 + i] = (struct pollfd){ .fd = clients[i].fd, .events = events };
+    }
+
+    if (poll(fds, 2 + count, next_timeout(now_ns())) < 0 && errno != EINTR)
+      break;
+    if (fds[1].revents)
+      break;
+
+    uint64_t now = now_ns();
+    for (int i = 0; i < count; i++) {
+      struct QueryClient* c = &clients[i];
+      if (fds[2 + i].revents && c->out.len)
+        client_write(c, now);
+      else if (fds[2 + i].revents)
+        client_read(c, now);
+
+      if (c->fd >= 0 && c->deadline && now >= c->deadline)
+        client_close(c);
+    }
+
+    compact_clients();
+
+    if (fds[0].revents & POLLIN)
+      accept_clients();
+  }
+
+  for (int i = 0; i < client_count; i++)
+    client_close(&clients[i]);
+  client_count = 0;
+  return NULL;
+}
+
+int
+query_init(void)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  ipc_query_socket_path(addr.sun_path, sizeof(addr.sun_path));
+  snprintf(socket_path, sizeof(socket_path), "%s", addr.sun_path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (listen_fd < 0)
+    return -1;
+
+  unlink(socket_path);
+  if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      chmod(socket_path, S_IRUSR | S_IWUSR) < 0 || listen(listen_fd, 16) < 0 ||
+      pipe2(wake_fds, O_CLOEXEC) < 0) {
+    log_error("Failed to listen on %s: %s", socket_path, strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+
+  if (pthread_create(&thread, NULL, query_thread, NULL) != 0) {
+    log_error("Failed to start query thread");
+    close(listen_fd);
+    close(wake_fds[0]);
+    close(wake_fds[1]);
+    listen_fd = -1;
+    return -1;
+  }
+
+  log_info("Serving queries on %s", socket_path);
+  return 0;
+}
+
+void
+query_shutdown(void)
+{
+  if (listen_fd < 0)
+    return;
+
+  if (write(wake_fds[1], "", 1) == 1)
+    pthread_join(thread, NULL);
+
+  close(listen_fd);
+  close(wake_fds[0]);
+  close(wake_fds[1]);
+  unlink(socket_path);
+  listen_fd = -1;
+
+  pthread_mutex_lock(&current_lock);
+  snapshot_release(current);
+  current = NULL;
+  pthread_mutex_unlock(&current_lock);
+}
@@ -0,0 +1,45 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Window as seen by queries
+struct QueryWindow
+{
+  uint32_t id;
+  uint32_t frame;
+  int16_t x, y;
+  uint16_t width, height;
+  uint8_t workspace;
+  uint8_t state;
+  uint8_t focused; // Focused window of its workspace
+};
+
+// Immutable copy of the window model, shared with the query thread
+struct QuerySnapshot
+{
+  atomic_int refs;
+  uint64_t generation;
+  int current_workspace;
+  int window_count;
+  struct QueryWindow windows[];
+};
+
+// Start the query thread on the query socket, returns -1 on failure
+int
+query_init(void);
+
+// Allocate a snapshot with room for window_count windows
+struct QuerySnapshot*
+query_snapshot_new(int window_count);
+
+// Replace the published snapshot, which must not be modified afterwards
+void
+query_publish(struct QuerySnapshot* snap);
+
+// Stop the query thread and remove the socket
+void
+query_shutdown(void);
+
+#endif /* QUERY_H */
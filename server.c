@@ -0,0 +1,366 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "log.h"
+#include "server.h"
+
+#define SERVER_MAX_CLIENTS (SERVER_MAX_POLLFDS - 1)
+#define SERVER_MAX_REQUEST (8 + 4 * IPC_MAX_ARGS)
+#define SERVER_EVENT_BUFFER 16384    // Per subscriber, more events are dropped
+#define SERVER_MAX_BACKLOG (1 << 20) // Per client, replies beyond close it
+#define SERVER_EVENT_SIZE (4 + sizeof(struct IpcEvent))
+
+struct Client
+{
+  int fd;                           // -1 once closed
+  uint8_t in[SERVER_MAX_REQUEST];   // Partial request
+  size_t in_len;
+  uint8_t* out;                     // Queued replies or events
+  size_t out_len;
+  size_t out_cap;
+  bool subscribed;                  // Streaming events, no more requests
+  uint32_t dropped;                 // Events lost since the last notice
+};
+
+static int listen_fd = -1;
+static char socket_path[108];
+static ServerExecute execute;
+static ServerReport report;
+static struct Client clients[SERVER_MAX_CLIENTS];
+static int client_count;
+
+int
+server_init(ServerExecute fn, ServerReport report_fn)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  ipc_socket_path(addr.sun_path, sizeof(addr.sun_path));
+  snprintf(socket_path, sizeof(socket_path), "%s", addr.sun_path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (listen_fd < 0)
+    return -1;
+
+  // A socket left behind by a crashed or restarted wm is replaced
+  unlink(socket_path);
+  if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      chmod(socket_path, S_IRUSR | S_IWUSR) < 0 || listen(listen_fd, 16) < 0) {
+    log_error("Failed to listen on %s: %s", socket_path, strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+
+  execute = fn;
+  report = report_fn;
+  log_info("Listening on %s", socket_path);
+  return 0;
+}
+
+int
+server_pollfds(struct pollfd* fds, int max)
+{
+  int n = 0;
+
+  if (listen_fd < 0 || max < 1)
+    return 0;
+
+  fds[n++] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+  for (int i = 0; i < client_count && n < max; i++) {
+    short events = POLLIN;
+    if (clients[i].out_len)
+      events |= POLLOUT;
+    fds[n++] = (struct pollfd){ .fd = clients[i].fd, .events = events };
+  }
+
+  return n;
+}
+
+static void
+client_close(struct Client* c)
+{
+  close(c->fd);
+  free(c->out);
+  memset(c, 0, sizeof(*c));
+  c->fd = -1;
+}
+
+static void
+client_reply(struct Client* c, int status, const char* text)
+{
+  size_t text_len = text ? strlen(text) : 0;
+  uint32_t length = 4 + text_len;
+  int32_t st = status;
+
+  // A client that sends but never reads must not grow the buffer forever
+  if (!c->subscribed && c->out_len + 4 + length > SERVER_MAX_BACKLOG) {
+    log_warn("Closing a command client that stopped reading replies");
+    client_close(c);
+    return;
+  }
+
+  if (c->out_len + 4 + length > c->out_cap) {
+    size_t cap = c->out_cap ? c->out_cap : 256;
+    while (cap < c->out_len + 4 + length)
+      cap *= 2;
+    uint8_t* out = realloc(c->out, cap);
+    if (!out) {
+      client_close(c);
+      return;
+    }
+    c->out = out;
+    c->out_cap = cap;
+  }
+
+  memcpy(c->out + c->out_len, &length, 4);
+  memcpy(c->out + c->out_len + 4, &st, 4);
+  if (text_len)
+    memcpy(c->out + c->out_len + 8, text, text_len);
+  c->out_len += 4 + length;
+}
+
+// Run every complete request in the input buffer
+static int
+client_process(struct Client* c)
+{
+  int executed = 0;
+
+  while (c->fd >= 0 && c->in_len >= 4) {
+    uint32_t length;
+    memcpy(&length, c->in, 4);
+    if (length < 4 || 4 + length > SERVER_MAX_REQUEST) {
+      client_close(c);
+      break;
+    }
+    if (c->in_len < 4 + length)
+      break;
+
+    uint16_t command, arg_count;
+    memcpy(&command, c->in + 4, 2);
+    memcpy(&arg_count, c->in + 6, 2);
+
+    uint32_t args[IPC_MAX_ARGS] = { 0 };
+    int status;
+    char* stats = NULL;
+    if (command == IPC_SUBSCRIBE && length == 4) {
+      client_reply(c, IPC_OK, NULL);
+      if (c->fd < 0)
+        break;
+
+      // From now on the output buffer has a fixed size. Replies still
+      // queued keep it larger until client_write() has sent them.
+      size_t cap =
+        c->out_len > SERVER_EVENT_BUFFER ? c->out_len : SERVER_EVENT_BUFFER;
+      uint8_t* out = realloc(c->out, cap);
+      if (!out) {
+        client_close(c);
+        break;
+      }
+      c->out = out;
+      c->out_cap = cap;
+      c->subscribed = true;
+      c->in_len = 0;
+      log_debug("Client subscribed to events");
+      break;
+    } else if (command == IPC_STATS && length == 4) {
+      stats = report();
+      status = stats ? IPC_OK : IPC_ERR_FAILED;
+    } else if (command >= COMMAND_COUNT) {
+      status = IPC_ERR_UNKNOWN_COMMAND;
+    } else if (arg_count != commands[command].arg_count ||
+               length != 4 + 4u * arg_count) {
+      status = IPC_ERR_ARGUMENTS;
+    } else {
+      memcpy(args, c->in + 8, 4 * arg_count);
+      status = execute(command, args);
+      executed++;
+    }
+    if (stats)
+      client_reply(c, status, stats);
+    else
+      client_reply(c, status, status ? ipc_status_string(status) : NULL);
+    free(stats);
+    if (c->fd < 0)
+      break;
+
+    memmove(c->in, c->in + 4 + length, c->in_len - 4 - length);
+    c->in_len -= 4 + length;
+  }
+
+  return executed;
+}
+
+static void
+client_read(struct Client* c)
+{
+  ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    client_close(c);
+    return;
+  }
+
+  // Subscribers have nothing more to say, anything they send is dropped
+  if (n > 0 && !c->subscribed)
+    c->in_len += n;
+}
+
+// Queue an event unless the subscriber's buffer is full
+static bool
+client_event(struct Client* c, const struct IpcEvent* ev)
+{
+  if (c->out_len + SERVER_EVENT_SIZE > c->out_cap)
+    return false;
+
+  uint32_t length = sizeof(*ev);
+  memcpy(c->out + c->out_len, &length, 4);
+  memcpy(c->out + c->out_len + 4, ev, sizeof(*ev));
+  c->out_len += SERVER_EVENT_SIZE;
+  return true;
+}
+
+static void
+client_write(struct Client* c)
+{
+  while (c->out_len) {
+    ssize_t n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      return;
+    if (n <= 0) {
+      client_close(c);
+      return;
+    }
+    memmove(c->out, c->out + n, c->out_len - n);
+    c->out_len -= n;
+  }
+
+  // The replies a subscriber had queued are out, back to the fixed size
+  if (c->subscribed && c->out_cap > SERVER_EVENT_BUFFER) {
+    uint8_t* out = realloc(c->out, SERVER_EVENT_BUFFER);
+    if (out) {
+      c->out = out;
+      c->out_cap = SERVER_EVENT_BUFFER;
+    }
+  }
+}
+
+static void
+accept_clients(void)
+{
+  for (;;) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0)
+      return;
+
+    if (client_count == SERVER_MAX_CLIENTS) {
+      log_warn("Too many command clients");
+      close(fd);
+      continue;
+    }
+
+    struct Client* c = &clients[client_count++];
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+  }
+}
+
+// Drop closed clients, keeping the rest in order
+static void
+compact_clients(void)
+{
+  int n = 0;
+  for (int i = 0; i < client_count; i++) {
+    if (clients[i].fd >= 0)
+      clients[n++] = clients[i];
+  }
+  client_count = n;
+}
+
+int
+server_dispatch(const struct pollfd* fds, int count)
+{
+  int executed = 0;
+
+  if (listen_fd < 0 || count < 1)
+    return 0;
+
+  // fds mirrors server_pollfds(): listener first, then clients in order
+  for (int i = 1; i < count && i - 1 < client_count; i++) {
+    struct Client* c = &clients[i - 1];
+    if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL) &&
+        !(fds[i].revents & POLLIN)) {
+      client_close(c);
+      continue;
+    }
+    if (fds[i].revents & POLLIN) {
+      client_read(c);
+      executed += client_process(c);
+    }
+  }
+
+  compact_clients();
+
+  if (fds[0].revents & POLLIN)
+    accept_clients();
+
+  return executed;
+}
+
+void
+server_flush(void)
+{
+  for (int i = 0; i < client_count; i++)
+    client_write(&clients[i]);
+
+  compact_clients();
+}
+
+void
+server_publish(const struct IpcEvent* ev)
+{
+  for (int i = 0; i < client_count; i++) {
+    struct Client* c = &clients[i];
+    if (!c->subscribed)
+      continue;
+
+    // Tell the subscriber what it missed once there is room again
+    if (c->dropped) {
+      struct IpcEvent notice = { .type = IPC_EVENT_DROPPED,
+                                 .value = c->dropped };
+      if (c->out_len + 2 * SERVER_EVENT_SIZE > c->out_cap ||
+          !client_event(c, &notice)) {
+        c->dropped++;
+        continue;
+      }
+      c->dropped = 0;
+    }
+
+    if (!client_event(c, ev))
+      c->dropped++;
+  }
+}
+
+void
+server_shutdown(void)
+{
+  for (int i = 0; i < client_count; i++)
+    client_close(&clients[i]);
+  client_count = 0;
+
+  if (listen_fd >= 0) {
+    close(listen_fd);
+    unlink(socket_path);
+    listen_fd = -1;
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <poll.h>
+#include <stdint.h>
+
+#include "ipc.h"
+
+// Upper bound on descriptors returned by server_pollfds()
+#define SERVER_MAX_POLLFDS 33
+
+// Runs a validated command and returns an IpcStatus
+typedef int (*ServerExecute)(int command, const uint32_t* args);
+
+// Returns text the server frees once queued, NULL on failure
+typedef char* (*ServerReport)(void);
+
+// Start listening on the command socket, returns -1 on failure
+int
+server_init(ServerExecute execute, ServerReport report);
+
+// Fill fds with the descriptors to poll, returns how many were used
+int
+server_pollfds(struct pollfd* fds, int max);
+
+// Accept clients and run complete requests, returns the number of commands
+int
+server_dispatch(const struct pollfd* fds, int count);
+
+// Write queued replies without blocking
+void
+server_flush(void);
+
+// Queue an event for every subscriber, never blocks
+void
+server_publish(const struct IpcEvent* ev);
+
+// Close every connection and remove the socket
+void
+server_shutdown(void);
+
+#endif /* SERVER_H */
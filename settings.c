@@ -0,0 +1,357 @@
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "log.h"
+#include "settings.h"
+
+// Compile-time defaults from config.h
+#define DEFAULT_SETTINGS                                                       \
+  {                                                                            \
+    .header_size = HEADER_SIZE, .border_size = BORDER_SIZE,                    \
+    .unfocused_border_color = UNFOCUSED_BORDER_COLOR,                          \
+    .unfocused_header_color = UNFOCUSED_HEADER_COLOR,                          \
+    .focused_border_color = FOCUSED_BORDER_COLOR,                              \
+    .focused_header_color = FOCUSED_HEADER_COLOR,                              \
+    .unfocused_title_color = UNFOCUSED_TITLE_COLOR,                            \
+    .focused_title_color = FOCUSED_TITLE_COLOR,                                \
+    .master_percent = LAYOUT_MASTER_PERCENT,                                   \
+    .motion_interval = 1000000000ull / MOTION_REFRESH_RATE,                    \
+    .log_level = DEFAULT_LOG_LEVEL,                                            \
+  }
+
+struct Settings settings = DEFAULT_SETTINGS;
+
+enum SettingType
+{
+  SETTING_INT,
+  SETTING_COLOR,
+  SETTING_RATE, // Per second, stored as an interval in nanoseconds
+  SETTING_LOG_LEVEL,
+};
+
+struct SettingKey
+{
+  const char* name;
+  enum SettingType type;
+  size_t offset;
+  long min, max; // Range of integer values
+};
+
+static const struct SettingKey keys[] = {
+  { "header_size",
+    SETTING_INT,
+    offsetof(struct Settings, header_size),
+    1,
+    200 },
+  { "border_size",
+    SETTING_INT,
+    offsetof(struct Settings, border_size),
+    0,
+    50 },
+  { "unfocused_border_color",
+    SETTING_COLOR,
+    offsetof(struct Settings, unfocused_border_color),
+    0,
+    0 },
+  { "unfocused_header_color",
+    SETTING_COLOR,
+    offsetof(struct Settings, unfocused_header_color),
+    0,
+    0 },
+  { "focused_border_color",
+    SETTING_COLOR,
+    offsetof(struct Settings, focused_border_color),
+    0,
+    0 },
+  { "focused_header_color",
+    SETTING_COLOR,
+    offsetof(struct Settings, focused_header_color),
+    0,
+    0 },
+  { "unfocused_title_color",
+    SETTING_COLOR,
+    offsetof(struct Settings, unfocused_title_color),
+    0,
+    0 },
+  { "focused_title_color",
+    SETTING_COLOR,
+    offsetof(struct Settings, focused_title_color),
+    0,
+    0 },
+  { "master_percent",
+    SETTING_INT,
+    offsetof(struct Settings, master_percent),
+    5,
+    95 },
+  { "motion_refresh_rate",
+    SETTING_RATE,
+    offsetof(struct Settings, motion_interval),
+    1,
+    1000 },
+  { "log_level",
+    SETTING_LOG_LEVEL,
+    offsetof(struct Settings, log_level),
+    0,
+    0 },
+};
+
+static char path_buf[PATH_MAX];
+static const char* watched_path;
+static const char* watched_name; // File name within the config directory
+static char config_dir[PATH_MAX];
+static int watched_wd = -1;
+static bool watching_ancestor; // Waiting for the config directory to appear
+
+const char*
+settings_path(void)
+{
+  const char* env = getenv("WM_CONFIG");
+  const char* xdg = getenv("XDG_CONFIG_HOME");
+  const char* home = getenv("HOME");
+  int n;
+
+  if (env && *env)
+    n = snprintf(path_buf, sizeof(path_buf), "%s", env);
+  else if (xdg && *xdg)
+    n = snprintf(path_buf, sizeof(path_buf), "%s/wm/config", xdg);
+  else if (home && *home)
+    n = snprintf(path_buf, sizeof(path_buf), "%s/.config/wm/config", home);
+  else
+    return NULL;
+
+  if (n < 0 || (size_t)n >= sizeof(path_buf))
+    return NULL;
+  return path_buf;
+}
+
+static char*
+trim(char* s)
+{
+  while (*s == ' ' || *s == '\t')
+    s++;
+
+  char* end = s + strlen(s);
+  while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' ||
+                     end[-1] == '\r'))
+    *--end = '\0';
+  return s;
+}
+
+static bool
+parse_value(const struct SettingKey* key, const char* value, void* field)
+{
+  char* end;
+
+  if (key->type == SETTING_COLOR) {
+    // #rrggbb or 0xrrggbb, which is the pixel on TrueColor visuals
+    if (*value == '#')
+      value++;
+    else if (strncmp(value, "0x", 2) == 0)
+      value += 2;
+
+    errno = 0;
+    unsigned long color = strtoul(value, &end, 16);
+    if (errno || end == value || *end || strlen(value) != 6)
+      return false;
+
+    *(uint32_t*)field = color;
+    return true;
+  }
+
+  if (key->type == SETTING_LOG_LEVEL) {
+    int level = log_level_from_name(value);
+    if (level < 0)
+      return false;
+
+    *(int*)field = level;
+    return true;
+  }
+
+  errno = 0;
+  long n = strtol(value, &end, 10);
+  if (errno || end == value || *end || n < key->min || n > key->max)
+    return false;
+
+  if (key->type == SETTING_RATE)
+    *(uint64_t*)field = 1000000000ull / n;
+  else
+    *(int*)field = n;
+  return true;
+}
+
+bool
+settings_load(const char* path, struct Settings* out)
+{
+  if (!path)
+    return false;
+
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    // Running without a config file is normal
+    if (errno != ENOENT)
+      log_warn("Failed to open config %s: %s", path, strerror(errno));
+    return false;
+  }
+
+  // Keys missing from the file fall back to their defaults
+  struct Settings next = DEFAULT_SETTINGS;
+
+  char line[256];
+  int lineno = 0;
+  bool ok = true;
+
+  while (ok && fgets(line, sizeof(line), file)) {
+    lineno++;
+
+    // Comments take a whole line or follow the value
+    char* key_name = trim(line);
+    if (!*key_name || *key_name == '#')
+      continue;
+
+    char* eq = strchr(key_name, '=');
+    if (!eq) {
+      log_error("Config %s:%d: expected key = value", path, lineno);
+      ok = false;
+      break;
+    }
+    *eq = '\0';
+    key_name = trim(key_name);
+    char* value = trim(eq + 1);
+
+    char* rest = value + strcspn(value, " \t");
+    if (*rest) {
+      *rest++ = '\0';
+      rest = trim(rest);
+    }
+    if (*rest && *rest != '#') {
+      log_error("Config %s:%d: trailing text after value", path, lineno);
+      ok = false;
+      break;
+    }
+
+    const struct SettingKey* key = NULL;
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+      if (strcmp(keys[i].name, key_name) == 0)
+        key = &keys[i];
+    }
+
+    if (!key) {
+      log_error("Config %s:%d: unknown key %s", path, lineno, key_name);
+      ok = false;
+    } else if (!parse_value(key, value, (char*)&next + key->offset)) {
+      log_error("Config %s:%d: bad value for %s", path, lineno, key_name);
+      ok = false;
+    }
+  }
+
+  fclose(file);
+  if (ok)
+    *out = next;
+  return ok;
+}
+
+// Watch the config directory, or while it is missing the nearest ancestor
+// that exists so its creation is noticed
+static bool
+watch_nearest(int fd)
+{
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", config_dir);
+
+  for (;;) {
+    bool ancestor = strcmp(dir, config_dir) != 0;
+    uint32_t mask = ancestor ? IN_CREATE | IN_MOVED_TO
+                             : IN_CLOSE_WRITE | IN_MOVED_TO;
+    int wd = inotify_add_watch(fd, dir, mask | IN_ONLYDIR);
+    if (wd >= 0) {
+      if (watched_wd >= 0 && watched_wd != wd)
+        inotify_rm_watch(fd, watched_wd);
+      watched_wd = wd;
+      watching_ancestor = ancestor;
+      return true;
+    }
+    if (errno != ENOENT && errno != ENOTDIR)
+      break;
+
+    char* slash = strrchr(dir, '/');
+    if (!slash || slash == dir) {
+      if (!slash || !slash[1])
+        break;
+      slash[1] = '\0';
+    } else {
+      *slash = '\0';
+    }
+  }
+
+  log_warn(
+    "Not watching config directory %s: %s", config_dir, strerror(errno));
+  return false;
+}
+
+int
+settings_watch(const char* path)
+{
+  if (!path)
+    return -1;
+
+  // Editors replace files by renaming over them, so watch the directory
+  snprintf(config_dir, sizeof(config_dir), "%s", path);
+  char* slash = strrchr(config_dir, '/');
+  if (slash == config_dir)
+    slash[1] = '\0';
+  else if (slash)
+    *slash = '\0';
+  else
+    snprintf(config_dir, sizeof(config_dir), ".");
+
+  const char* name = strrchr(path, '/');
+  watched_path = path;
+  watched_name = name ? name + 1 : path;
+
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  watched_wd = -1;
+  if (!watch_nearest(fd)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+bool
+settings_changed(int fd)
+{
+  char buf[4096]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+
+  for (;;) {
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len <= 0)
+      break;
+
+    for (char* p = buf; p < buf + len;) {
+      struct inotify_event* ev = (struct inotify_event*)p;
+      if (!watching_ancestor && ev->len && !strcmp(ev->name, watched_name))
+        changed = true;
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+
+  // Something appeared on the way to the config directory, move the watch
+  // down. A config written before the watch moved is picked up here.
+  if (watching_ancestor && watch_nearest(fd) && !watching_ancestor)
+    changed = access(watched_path, F_OK) == 0;
+
+  return changed;
+}
@@ -0,0 +1,48 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Runtime configuration. Starts out with the defaults from config.h and
+// is replaced as a whole when the config file is loaded.
+struct Settings
+{
+  int header_size; // Pixels
+  int border_size; // Pixels
+
+  // Ready to send pixel values
+  uint32_t unfocused_border_color;
+  uint32_t unfocused_header_color;
+  uint32_t focused_border_color;
+  uint32_t focused_header_color;
+  uint32_t unfocused_title_color;
+  uint32_t focused_title_color;
+
+  int master_percent;       // Master window share of the width
+  uint64_t motion_interval; // Nanoseconds between drag updates
+  int log_level;            // enum LogLevel
+};
+
+extern struct Settings settings;
+
+// Config file location: $WM_CONFIG, else $XDG_CONFIG_HOME/wm/config, else
+// ~/.config/wm/config. NULL if none can be determined.
+const char*
+settings_path(void);
+
+// Parse the config file on top of the defaults. On any error out is left
+// untouched and false is returned.
+bool
+settings_load(const char* path, struct Settings* out);
+
+// Watch the config file for changes, returns an inotify fd or -1. While
+// its directory is missing the nearest existing ancestor is watched.
+int
+settings_watch(const char* path);
+
+// Drain pending watch events, returns whether the config file changed
+bool
+settings_changed(int fd);
+
+#endif /* SETTINGS_H */
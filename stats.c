@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ipc.h"
+#include "stats.h"
+#include "utils.h"
+
+struct Stats
+{
+  struct Histogram latency;
+  struct XreqCounters x;
+};
+
+static struct Stats events[STATS_EVENT_TYPES];
+static struct Stats command_stats[COMMAND_COUNT];
+static struct Stats phases[STATS_PHASE_COUNT];
+
+static const char* phase_names[STATS_PHASE_COUNT] = {
+  [STATS_SETUP] = "setup",
+  [STATS_COMMIT] = "commit",
+};
+
+// Core protocol events, extension events are reported by number
+static const char* event_names[] = {
+  [0] = "error",
+  [XCB_KEY_PRESS] = "key-press",
+  [XCB_KEY_RELEASE] = "key-release",
+  [XCB_BUTTON_PRESS] = "button-press",
+  [XCB_BUTTON_RELEASE] = "button-release",
+  [XCB_MOTION_NOTIFY] = "motion-notify",
+  [XCB_ENTER_NOTIFY] = "enter-notify",
+  [XCB_LEAVE_NOTIFY] = "leave-notify",
+  [XCB_FOCUS_IN] = "focus-in",
+  [XCB_FOCUS_OUT] = "focus-out",
+  [XCB_KEYMAP_NOTIFY] = "keymap-notify",
+  [XCB_EXPOSE] = "expose",
+  [XCB_GRAPHICS_EXPOSURE] = "graphics-exposure",
+  [XCB_NO_EXPOSURE] = "no-exposure",
+  [XCB_VISIBILITY_NOTIFY] = "visibility-notify",
+  [XCB_CREATE_NOTIFY] = "create-notify",
+  [XCB_DESTROY_NOTIFY] = "destroy-notify",
+  [XCB_UNMAP_NOTIFY] = "unmap-notify",
+  [XCB_MAP_NOTIFY] = "map-notify",
+  [XCB_MAP_REQUEST] = "map-request",
+  [XCB_REPARENT_NOTIFY] = "reparent-notify",
+  [XCB_CONFIGURE_NOTIFY] = "configure-notify",
+  [XCB_CONFIGURE_REQUEST] = "configure-request",
+  [XCB_GRAVITY_NOTIFY] = "gravity-notify",
+  [XCB_RESIZE_REQUEST] = "resize-request",
+  [XCB_CIRCULATE_NOTIFY] = "circulate-notify",
+  [XCB_CIRCULATE_REQUEST] = "circulate-request",
+  [XCB_PROPERTY_NOTIFY] = "property-notify",
+  [XCB_SELECTION_CLEAR] = "selection-clear",
+  [XCB_SELECTION_REQUEST] = "selection-request",
+  [XCB_SELECTION_NOTIFY] = "selection-notify",
+  [XCB_COLORMAP_NOTIFY] = "colormap-notify",
+  [XCB_CLIENT_MESSAGE] = "client-message",
+  [XCB_MAPPING_NOTIFY] = "mapping-notify",
+  [XCB_GE_GENERIC] = "generic-event",
+};
+
+static void
+record(struct Histogram* h, uint64_t ns)
+{
+  int bucket = ns > 1 ? 63 - __builtin_clzll(ns) : 0;
+  if (bucket >= STATS_BUCKETS)
+    bucket = STATS_BUCKETS - 1;
+
+  h->count++;
+  h->total_ns += ns;
+  if (ns > h->max_ns)
+    h->max_ns = ns;
+  h->buckets[bucket]++;
+}
+
+static struct StatsScope
+begin(struct Stats* stats)
+{
+  return (struct StatsScope){
+    .latency = &stats->latency,
+    .outer = xreq_charge(&stats->x),
+    .start = now_ns(),
+  };
+}
+
+struct StatsScope
+stats_event(uint8_t type)
+{
+  return begin(&events[type & 0x7f]);
+}
+
+struct StatsScope
+stats_command(int command)
+{
+  return begin(&command_stats[command]);
+}
+
+struct StatsScope
+stats_phase(enum StatsPhase phase)
+{
+  return begin(&phases[phase]);
+}
+
+void
+stats_end(struct StatsScope scope)
+{
+  record(scope.latency, now_ns() - scope.start);
+  xreq_charge(scope.outer);
+}
+
+void
+stats_reset(void)
+{
+  memset(events, 0, sizeof(events));
+  memset(command_stats, 0, sizeof(command_stats));
+  memset(phases, 0, sizeof(phases));
+}
+
+// Upper bound of the bucket holding the given fraction of samples
+static uint64_t
+percentile(const struct Histogram* h, double fraction)
+{
+  uint64_t rank = h->count * fraction;
+  uint64_t seen = 0;
+
+  for (int i = 0; i < STATS_BUCKETS - 1; i++) {
+    seen += h->buckets[i];
+    if (seen > rank) {
+      uint64_t bound = 2ull << i;
+      return bound < h->max_ns ? bound : h->max_ns;
+    }
+  }
+  return h->max_ns;
+}
+
+static void
+format_stats(FILE* f, const char* kind, const char* name, const struct Stats* s)
+{
+  const struct Histogram* h = &s->latency;
+
+  fprintf(f,
+          "%s=%s count=%llu mean_ns=%llu p50_ns=%llu p99_ns=%llu "
+          "max_ns=%llu requests=%llu waits=%llu bytes=%llu flushes=%llu "
+          "buckets=",
+          kind,
+          name,
+          (unsigned long long)h->count,
+          (unsigned long long)(h->total_ns / h->count),
+          (unsigned long long)percentile(h, 0.5),
+          (unsigned long long)percentile(h, 0.99),
+          (unsigned long long)h->max_ns,
+          (unsigned long long)s->x.requests,
+          (unsigned long long)s->x.waits,
+          (unsigned long long)s->x.bytes,
+          (unsigned long long)s->x.flushes);
+
+  // Only buckets with samples, as log2 of the upper bound:count
+  const char* sep = "";
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    if (!h->buckets[i])
+      continue;
+    fprintf(f, "%s%d:%u", sep, i + 1, h->buckets[i]);
+    sep = ",";
+  }
+  fputc('\n', f);
+}
+
+char*
+stats_report(void)
+{
+  char* text = NULL;
+  size_t size;
+  FILE* f = open_memstream(&text, &size);
+  if (!f)
+    return NULL;
+
+  for (int i = 0; i < STATS_EVENT_TYPES; i++) {
+    if (!events[i].latency.count)
+      continue;
+
+    char number[16];
+    const char* name =
+      i < (int)(sizeof(event_names) / sizeof(*event_names)) ? event_names[i]
+                                                            : NULL;
+    if (!name) {
+      snprintf(number, sizeof(number), "%d", i);
+      name = number;
+    }
+    format_stats(f, "event", name, &events[i]);
+  }
+
+  for (int i = 0; i < COMMAND_COUNT; i++) {
+    if (command_stats[i].latency.count)
+      format_stats(f, "command", commands[i].name, &command_stats[i]);
+  }
+
+  for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+    if (phases[i].latency.count)
+      format_stats(f, "phase", phase_names[i], &phases[i]);
+  }
+
+  if (fclose(f) != 0) {
+    free(text);
+    return NULL;
+  }
+  return text;
+}
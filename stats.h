@@ -0,0 +1,64 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#include "xreq.h"
+
+// Latencies are counted in power of two buckets, bucket i holds those
+// below 2^(i+1) nanoseconds and the last one everything slower
+#define STATS_BUCKETS 40
+#define STATS_EVENT_TYPES 128 // Response type without the sent flag
+
+struct Histogram
+{
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint32_t buckets[STATS_BUCKETS];
+};
+
+// Work done outside event and command handlers. Handlers only change the
+// model: the configures, maps and repaints that put a change on screen
+// are sent by the commit ending the batch and are charged to
+// STATS_COMMIT, not to the event or command that caused them. A
+// focus-next, for example, costs its command line plus the commit after
+// it. With one command per batch the two lines add up to its full cost.
+enum StatsPhase
+{
+  STATS_SETUP,  // Everything before the event loop
+  STATS_COMMIT, // Sending what a batch changed, for whichever handler
+  STATS_PHASE_COUNT
+};
+
+// Work being timed, its X traffic is charged to it until stats_end()
+struct StatsScope
+{
+  struct Histogram* latency;
+  struct XreqCounters* outer;
+  uint64_t start;
+};
+
+struct StatsScope
+stats_event(uint8_t type);
+
+struct StatsScope
+stats_command(int command);
+
+struct StatsScope
+stats_phase(enum StatsPhase phase);
+
+// Record the latency and charge X traffic to the enclosing scope again
+void
+stats_end(struct StatsScope scope);
+
+// Forget everything recorded so far
+void
+stats_reset(void);
+
+// Describe everything recorded, one line per event type, command or
+// phase seen. The caller frees the result, NULL if out of memory.
+char*
+stats_report(void);
+
+#endif /* STATS_H */
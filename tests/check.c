@@ -0,0 +1,649 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+#include "config.h"
+#include "ipc.h"
+#include "layout.h"
+#include "log.h"
+#include "query.h"
+#include "server.h"
+#include "settings.h"
+#include "utils.h"
+#include "wm.h"
+#include "xreq.h"
+#include "xreq_fake.h"
+
+// Drives the wm handlers against the fake X server and checks what ends
+// up on it. Tests share one wm and clean up after themselves.
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+static int failures;
+
+static void
+check(bool ok, const char* what, const char* file, int line)
+{
+  if (ok)
+    return;
+  fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+  failures++;
+}
+
+// Hand the wm whatever the fake server queued, as one batch
+static void
+drain(void)
+{
+  xcb_generic_event_t* ev;
+  while ((ev = xreq_poll_for_event(NULL))) {
+    wm_dispatch(ev);
+    free(ev);
+  }
+  wm_commit();
+}
+
+static const struct FakeWindow*
+window(xcb_window_t id)
+{
+  const struct FakeWindow* win = xreq_fake_window(id);
+  if (!win)
+    die("Window %u does not exist", id);
+  return win;
+}
+
+static xcb_window_t
+frame_of(xcb_window_t client)
+{
+  return window(client)->parent;
+}
+
+static xcb_window_t
+container_of(xcb_window_t client)
+{
+  return window(frame_of(client))->parent;
+}
+
+// Visible whether hidden workspaces are unmapped or parked offscreen
+static bool
+shown(xcb_window_t id)
+{
+  const struct FakeWindow* win = window(id);
+  return win->mapped && win->x >= 0;
+}
+
+static int
+command(int command, uint32_t arg)
+{
+  uint32_t args[IPC_MAX_ARGS] = { arg };
+  int status = wm_execute(command, args);
+  wm_commit();
+  return status;
+}
+
+static void
+configure_request(xcb_window_t id,
+                  int16_t x,
+                  int16_t y,
+                  uint16_t width,
+                  uint16_t height)
+{
+  xcb_generic_event_t ev = { 0 };
+  xcb_configure_request_event_t* cr = (xcb_configure_request_event_t*)&ev;
+  cr->response_type = XCB_CONFIGURE_REQUEST;
+  cr->parent = window(id)->parent;
+  cr->window = id;
+  cr->x = x;
+  cr->y = y;
+  cr->width = width;
+  cr->height = height;
+  cr->value_mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                   XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+  xreq_fake_push_event(&ev);
+}
+
+// Create a client and have the wm frame it
+static xcb_window_t
+map_client(int16_t x, int16_t y, uint16_t width, uint16_t height)
+{
+  xcb_window_t id = xreq_fake_create_client("client", x, y, width, height);
+  xreq_fake_map_request(id);
+  drain();
+  return id;
+}
+
+static void
+destroy_client(xcb_window_t id)
+{
+  xreq_fake_destroy_client(id);
+  drain();
+}
+
+static void
+test_map(void)
+{
+  xcb_window_t id = map_client(50, 80, 100, 100);
+  const struct FakeWindow* client = window(id);
+  const struct FakeWindow* frame = window(frame_of(id));
+
+  CHECK(client->mapped);
+  CHECK(client->width == 100 && client->height == 100);
+  CHECK(client->y == settings.header_size);
+  CHECK(frame->mapped);
+  CHECK(frame->width == 100);
+  CHECK(frame->height == 100 + settings.header_size);
+  CHECK(frame->border_width == settings.border_size);
+  CHECK(shown(container_of(id)));
+
+  destroy_client(id);
+  CHECK(!xreq_fake_window(id));
+}
+
+// Windows the wm does not manage get their request as sent
+static void
+test_configure_unmanaged(void)
+{
+  xcb_window_t id = xreq_fake_create_client("client", 0, 0, 100, 100);
+  configure_request(id, 10, 20, 300, 200);
+  drain();
+
+  const struct FakeWindow* client = window(id);
+  CHECK(client->x == 10 && client->y == 20);
+  CHECK(client->width == 300 && client->height == 200);
+
+  destroy_client(id);
+}
+
+// Titles past what ImageText8 takes are cut and marked like wide ones
+static void
+test_long_title(void)
+{
+  char name[301];
+  memset(name, 'a', 300);
+  name[300] = '\0';
+
+  xcb_window_t id = xreq_fake_create_client(name, 0, 0, 1900, 100);
+  xreq_fake_map_request(id);
+  drain();
+
+  const char* drawn = xreq_fake_drawn_text();
+  CHECK(strlen(drawn) == 255);
+  CHECK(!strcmp(drawn + 252, "..."));
+
+  destroy_client(id);
+}
+
+static char socket_dir[] = "/tmp/wm-check-XXXXXX";
+
+// Point the command and query sockets into a fresh directory
+static void
+use_socket_dir(void)
+{
+  char path[108];
+  strcpy(socket_dir + sizeof(socket_dir) - 7, "XXXXXX");
+  if (!mkdtemp(socket_dir))
+    die("Failed to create a socket directory");
+  snprintf(path, sizeof(path), "%s/wm.sock", socket_dir);
+  setenv("WM_SOCKET", path, 1);
+}
+
+static void
+drop_socket_dir(void)
+{
+  unsetenv("WM_SOCKET");
+  rmdir(socket_dir);
+}
+
+// A query client stalled halfway through its request holds up nobody
+static void
+test_query_stall(void)
+{
+  use_socket_dir();
+  CHECK(query_init() == 0);
+  query_publish(query_snapshot_new(0));
+
+  int stalled = ipc_connect_query();
+  uint32_t length = 4;
+  CHECK(stalled >= 0 && write(stalled, &length, 4) == 4);
+
+  // Long enough that a client served in turn would fail
+  int fd = ipc_connect_query();
+  struct timeval timeout = { .tv_usec = 500000 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  CHECK(ipc_send_request(fd, IPC_QUERY_GET_STATE, NULL, 0) == 0);
+
+  int status = -1;
+  char* text = ipc_read_reply_alloc(fd, &status);
+  CHECK(text && status == IPC_OK && strstr(text, "windows=0"));
+
+  free(text);
+  close(fd);
+  close(stalled);
+  query_shutdown();
+  drop_socket_dir();
+}
+
+// Let the command server read and answer everything its clients sent,
+// without writing any reply back
+static void
+serve(void)
+{
+  struct pollfd fds[SERVER_MAX_POLLFDS];
+  for (;;) {
+    int count = server_pollfds(fds, SERVER_MAX_POLLFDS);
+    for (int i = 0; i < count; i++)
+      fds[i].events = POLLIN;
+    if (poll(fds, count, 0) <= 0)
+      return;
+    server_dispatch(fds, count);
+  }
+}
+
+// A client that only sends is cut off once its replies pile up
+static void
+test_backlog_cap(void)
+{
+  use_socket_dir();
+  CHECK(server_init(NULL, NULL) == 0);
+  int fd = ipc_connect();
+  struct timeval timeout = { .tv_sec = 1 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  // About 2 MiB of 23 byte replies, none of them read
+  for (int i = 0; i < 100000; i++) {
+    if (ipc_send_request(fd, COMMAND_COUNT, NULL, 0) < 0)
+      break;
+    serve();
+  }
+
+  char c;
+  ssize_t n = recv(fd, &c, 1, 0);
+  CHECK(n == 0 || (n < 0 && errno == ECONNRESET));
+
+  close(fd);
+  server_shutdown();
+  drop_socket_dir();
+}
+
+// Replies queued past the event buffer survive a subscribe, in order
+static void
+test_subscribe_backlog(void)
+{
+  use_socket_dir();
+  CHECK(server_init(NULL, NULL) == 0);
+  int fd = ipc_connect();
+  struct timeval timeout = { .tv_sec = 1 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  // Unknown commands never reach the wm, each reply is 23 bytes
+  int queued = 2000;
+  for (int i = 0; i < queued; i++) {
+    CHECK(ipc_send_request(fd, COMMAND_COUNT, NULL, 0) == 0);
+    serve();
+  }
+  CHECK(ipc_send_request(fd, IPC_SUBSCRIBE, NULL, 0) == 0);
+  serve();
+
+  struct IpcEvent ev = { .type = IPC_EVENT_FOCUS, .window = 42 };
+  server_publish(&ev);
+  server_flush();
+
+  int status = -1;
+  char text[64];
+  for (int i = 0; i < queued; i++) {
+    if (ipc_read_reply(fd, &status, text, sizeof(text)) < 0 ||
+        status != IPC_ERR_UNKNOWN_COMMAND)
+      break;
+  }
+  CHECK(status == IPC_ERR_UNKNOWN_COMMAND);
+  CHECK(ipc_read_reply(fd, &status, text, sizeof(text)) == 0);
+  CHECK(status == IPC_OK);
+
+  // The backlog left no room for the first event, the buffer has its
+  // fixed size again for the second
+  struct IpcEvent got = { 0 };
+  server_publish(&ev);
+  server_flush();
+  CHECK(ipc_read_event(fd, &got) == 0);
+  CHECK(got.type == IPC_EVENT_DROPPED && got.value == 1);
+  CHECK(ipc_read_event(fd, &got) == 0);
+  CHECK(got.type == IPC_EVENT_FOCUS && got.window == 42);
+
+  close(fd);
+  server_shutdown();
+  drop_socket_dir();
+}
+
+// A client resizing itself right before it maps is framed at the new size
+static void
+test_configure_then_map(void)
+{
+  xcb_window_t id = xreq_fake_create_client("client", 0, 0, 100, 100);
+  configure_request(id, 0, 0, 800, 600);
+  xreq_fake_map_request(id);
+  drain();
+
+  const struct FakeWindow* frame = window(frame_of(id));
+  CHECK(window(id)->width == 800 && window(id)->height == 600);
+  CHECK(frame->width == 800);
+  CHECK(frame->height == 600 + settings.header_size);
+
+  destroy_client(id);
+}
+
+// A managed client that resizes itself keeps the size through repaints
+static void
+test_configure_managed(void)
+{
+  xcb_window_t a = map_client(0, 0, 100, 100);
+  configure_request(a, 0, settings.header_size, 300, 200);
+  drain();
+  CHECK(window(a)->width == 300 && window(a)->height == 200);
+
+  // Focus moving away repaints a
+  xcb_window_t b = map_client(0, 0, 100, 100);
+  CHECK(window(a)->width == 300 && window(a)->height == 200);
+
+  destroy_client(a);
+  destroy_client(b);
+}
+
+static bool
+same_geometry(const struct FakeWindow* a, const struct FakeWindow* b)
+{
+  return a->x == b->x && a->y == b->y && a->width == b->width &&
+         a->height == b->height && a->border_width == b->border_width;
+}
+
+static uint64_t
+requests(void)
+{
+  uint64_t total = 0;
+  for (int opcode = 0; opcode < 256; opcode++)
+    total += xreq_fake_count(opcode);
+  return total;
+}
+
+// Requests one focus-next sends, commit included
+static uint64_t
+focus_next_cost(void)
+{
+  // The first step may still draw titles
+  command(COMMAND_FOCUS_NEXT, 0);
+  xreq_fake_reset();
+  CHECK(command(COMMAND_FOCUS_NEXT, 0) == IPC_OK);
+  return requests();
+}
+
+// Focus moves at the same cost however many windows share the workspace
+static void
+test_focus_cost(void)
+{
+  xcb_window_t clients[32];
+  int count = 0;
+
+  while (count < 4)
+    clients[count++] = map_client(0, 0, 100, 100);
+  uint64_t few = focus_next_cost();
+
+  while (count < 32)
+    clients[count++] = map_client(0, 0, 100, 100);
+  uint64_t many = focus_next_cost();
+
+  CHECK(few > 0);
+  CHECK(few == many);
+
+  while (count)
+    destroy_client(clients[--count]);
+}
+
+// More stacked windows than the screen has room for still get frames
+// that hold the header and a client
+static void
+test_tiny_tiles(void)
+{
+  xcb_window_t clients[60];
+  int count = 0;
+
+  CHECK(command(COMMAND_LAYOUT, LAYOUT_MASTER_STACK) == IPC_OK);
+  while (count < 60)
+    clients[count++] = map_client(0, 0, 100, 100);
+
+  for (int i = 0; i < count; i++) {
+    const struct FakeWindow* client = window(clients[i]);
+    const struct FakeWindow* frame = window(frame_of(clients[i]));
+    CHECK(frame->height > settings.header_size);
+    CHECK(frame->height < 1080);
+    CHECK(client->height >= 1);
+    CHECK(client->y + client->height <= frame->height);
+    CHECK(client->width <= frame->width);
+  }
+
+  CHECK(command(COMMAND_LAYOUT, LAYOUT_FLOATING) == IPC_OK);
+  while (count)
+    destroy_client(clients[--count]);
+}
+
+// Reloading unchanged settings leaves every window where it was
+static void
+test_reload(void)
+{
+  xcb_window_t a = map_client(30, 60, 100, 100);
+  xcb_window_t b = map_client(0, 0, 200, 150);
+  CHECK(command(COMMAND_MAXIMIZE, 0) == IPC_OK);
+
+  struct FakeWindow before[4] = { *window(a),
+                                  *window(frame_of(a)),
+                                  *window(b),
+                                  *window(frame_of(b)) };
+  xreq_fake_reset();
+  wm_reload();
+  wm_commit();
+
+  CHECK(same_geometry(window(a), &before[0]));
+  CHECK(same_geometry(window(frame_of(a)), &before[1]));
+  CHECK(same_geometry(window(b), &before[2]));
+  CHECK(same_geometry(window(frame_of(b)), &before[3]));
+  CHECK(xreq_fake_count(XCB_CONFIGURE_WINDOW) == 0);
+
+  destroy_client(a);
+  destroy_client(b);
+}
+
+// A header reloaded taller than a window grows its frame rather than
+// wrapping the client height
+static void
+test_tall_header(void)
+{
+  char path[] = "/tmp/wm-check-config-XXXXXX";
+  int fd = mkstemp(path);
+  const char config[] = "header_size = 200\n";
+  CHECK(fd >= 0 && write(fd, config, sizeof(config) - 1) > 0);
+  close(fd);
+
+  xcb_window_t a = map_client(30, 60, 100, 50);
+  setenv("WM_CONFIG", path, 1);
+  wm_reload();
+  wm_commit();
+
+  const struct FakeWindow* frame = window(frame_of(a));
+  CHECK(settings.header_size == 200);
+  CHECK(frame->height > 200);
+  CHECK(window(a)->height >= 1);
+  CHECK(window(a)->y + window(a)->height <= frame->height);
+
+  setenv("WM_CONFIG", "/dev/null", 1);
+  wm_reload();
+  wm_commit();
+  unlink(path);
+  destroy_client(a);
+}
+
+#define MAX_SNAPSHOT 64
+
+static struct FakeWindow snapshot[MAX_SNAPSHOT];
+static int snapshot_count;
+
+static void
+take_snapshot(const struct FakeWindow* win)
+{
+  if (snapshot_count == MAX_SNAPSHOT)
+    die("Too many windows to snapshot");
+  snapshot[snapshot_count++] = *win;
+  for (const struct FakeWindow* c = win->first_child; c; c = c->below)
+    take_snapshot(c);
+}
+
+// Runs in the process the restart execs, with the windows the previous
+// one left behind
+static int
+check_restored(char* program, int fd)
+{
+  take_snapshot(window(FAKE_ROOT));
+  wm_setup(program, fd);
+  wm_commit();
+
+  for (int i = 0; i < snapshot_count; i++) {
+    const struct FakeWindow* now = window(snapshot[i].id);
+    CHECK(now->parent == snapshot[i].parent);
+    CHECK(now->mapped == snapshot[i].mapped);
+    CHECK(same_geometry(now, &snapshot[i]));
+  }
+  CHECK(xreq_fake_count(XCB_REPARENT_WINDOW) == 0);
+
+  // Hidden containers may be unmapped again, nothing shown may blink
+  CHECK(requests() <= FAKE_LOG_SIZE);
+  const struct FakeRequest* r;
+  for (unsigned int back = 0; (r = xreq_fake_request(back)); back++) {
+    if (r->opcode != XCB_UNMAP_WINDOW)
+      continue;
+    for (int i = 0; i < snapshot_count; i++)
+      CHECK(snapshot[i].id != r->target || !snapshot[i].mapped);
+  }
+
+  wm_shutdown();
+  log_stop();
+  return failures ? 1 : 0;
+}
+
+// A restart takes over every frame without moving anything on screen
+static void
+test_restart(void)
+{
+  xcb_window_t a = map_client(30, 60, 100, 100);
+  xcb_window_t b = map_client(0, 0, 200, 150);
+  CHECK(command(COMMAND_MAXIMIZE, 0) == IPC_OK);
+
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid == 0) {
+    wm_restart();
+    _exit(2);
+  }
+
+  int status;
+  CHECK(pid > 0 && waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  destroy_client(a);
+  destroy_client(b);
+}
+
+// The focused frame is raised and wears the focused colors
+static void
+test_focus(void)
+{
+  xcb_window_t a = map_client(0, 0, 100, 100);
+  xcb_window_t b = map_client(200, 0, 100, 100);
+
+  CHECK(window(container_of(b))->first_child->id == frame_of(b));
+  CHECK(window(frame_of(b))->border_pixel == settings.focused_border_color);
+  CHECK(window(frame_of(a))->border_pixel == settings.unfocused_border_color);
+
+  CHECK(command(COMMAND_FOCUS_NEXT, 0) == IPC_OK);
+  CHECK(window(container_of(a))->first_child->id == frame_of(a));
+  CHECK(window(frame_of(a))->border_pixel == settings.focused_border_color);
+  CHECK(window(frame_of(b))->border_pixel == settings.unfocused_border_color);
+
+  destroy_client(a);
+  destroy_client(b);
+}
+
+static void
+test_switch(void)
+{
+  xcb_window_t a = map_client(0, 0, 100, 100);
+  xcb_window_t first = container_of(a);
+
+  CHECK(command(COMMAND_SWITCH_WORKSPACE, 1) == IPC_OK);
+  CHECK(!shown(first));
+
+  xcb_window_t b = map_client(0, 0, 100, 100);
+  xcb_window_t second = container_of(b);
+  CHECK(second != first);
+  CHECK(shown(second));
+
+  CHECK(command(COMMAND_SWITCH_WORKSPACE, 0) == IPC_OK);
+  CHECK(shown(first));
+  CHECK(!shown(second));
+  CHECK(command(COMMAND_SWITCH_WORKSPACE, MAX_WORKSPACES) ==
+        IPC_ERR_WORKSPACE);
+  CHECK(command(COMMAND_FOCUS_OUTPUT, 1) == IPC_ERR_OUTPUT);
+  CHECK(command(COMMAND_FOCUS_OUTPUT, 0) == IPC_OK);
+
+  destroy_client(a);
+  destroy_client(b);
+}
+
+static const struct
+{
+  const char* name;
+  void (*run)(void);
+} tests[] = {
+  { "map", test_map },
+  { "configure-unmanaged", test_configure_unmanaged },
+  { "configure-then-map", test_configure_then_map },
+  { "configure-managed", test_configure_managed },
+  { "long-title", test_long_title },
+  { "focus", test_focus },
+  { "focus-cost", test_focus_cost },
+  { "tiny-tiles", test_tiny_tiles },
+  { "reload", test_reload },
+  { "tall-header", test_tall_header },
+  { "restart", test_restart },
+  { "switch", test_switch },
+  { "query-stall", test_query_stall },
+  { "subscribe-backlog", test_subscribe_backlog },
+  { "backlog-cap", test_backlog_cap },
+};
+
+int
+main(int argc, char* argv[])
+{
+  // Defaults only, a personal config would change the expectations
+  setenv("WM_CONFIG", "/dev/null", 1);
+  xreq_use(&xreq_fake);
+  log_start();
+
+  if (argc == 3 && !strcmp(argv[1], "--restore"))
+    return check_restored(argv[0], atoi(argv[2]));
+
+  wm_setup(argv[0], -1);
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    int before = failures;
+    tests[i].run();
+    printf("%s %s\n", failures == before ? "ok" : "FAIL", tests[i].name);
+  }
+
+  wm_shutdown();
+  log_stop();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xcb/xcb.h>
+
+#include "config.h"
+#include "settings.h"
+#include "title.h"
+#include "utils.h"
+#include "xreq.h"
+
+#define TEXT8_MAX 255 // ImageText8 has a one byte length
+
+static xcb_connection_t* conn;
+static xcb_screen_t* screen;
+static xcb_font_t font;
+static xcb_gcontext_t gc;
+
+// Glyph metrics fetched once, text is measured without the server
+static struct
+{
+  uint16_t widths[256];
+  int16_t ascent, descent;
+} glyphs = { 0 };
+
+void
+title_init(xcb_connection_t* c, xcb_screen_t* s)
+{
+  conn = c;
+  screen = s;
+
+  font = xreq_generate_id(conn);
+  xreq_open_font(conn, font, strlen(TITLE_FONT), TITLE_FONT);
+
+  xcb_query_font_reply_t* info =
+    xreq_query_font_reply(conn, xreq_query_font(conn, font), NULL);
+  if (!info)
+    die("Failed to open font %s", TITLE_FONT);
+
+  glyphs.ascent = info->font_ascent;
+  glyphs.descent = info->font_descent;
+
+  // Fonts without per glyph metrics have all glyphs as wide as the widest
+  xcb_charinfo_t* infos = xcb_query_font_char_infos(info);
+  int count = xcb_query_font_char_infos_length(info);
+  for (int ch = 0; ch < 256; ch++) {
+    int index = ch - info->min_char_or_byte2;
+    if (!count)
+      glyphs.widths[ch] = info->max_bounds.character_width;
+    else if (index >= 0 && index < count)
+      glyphs.widths[ch] = infos[index].character_width;
+  }
+  free(info);
+
+  gc = xreq_generate_id(conn);
+  uint32_t values[] = { font, 0 };
+  xreq_create_gc(conn,
+                 gc,
+                 screen->root,
+                 XCB_GC_FONT | XCB_GC_GRAPHICS_EXPOSURES,
+                 values);
+}
+
+char*
+title_from_property(const char* value, size_t len, bool utf8)
+{
+  char* text = malloc(len + 1);
+  if (!text)
+    die("Failed to allocate title");
+
+  // Code points past Latin-1 have no glyph in the core font
+  size_t n = 0;
+  for (size_t i = 0; i < len && value[i]; i++) {
+    unsigned char ch = value[i];
+    if (!utf8 || ch < 0x80) {
+      text[n++] = ch;
+      continue;
+    }
+
+    int extra = ch >= 0xf0 ? 3 : ch >= 0xe0 ? 2 : 1;
+    uint32_t code = ch & (0x3f >> extra);
+    for (; extra && i + 1 < len; extra--)
+      code = (code << 6) | (value[++i] & 0x3f);
+    text[n++] = code < 0x100 ? (char)code : '?';
+  }
+  text[n] = '\0';
+
+  return text;
+}
+
+static int
+text_width(const char* text, size_t len)
+{
+  int width = 0;
+  for (size_t i = 0; i < len; i++)
+    width += glyphs.widths[(unsigned char)text[i]];
+  return width;
+}
+
+xcb_pixmap_t
+title_render(const char* text,
+             uint16_t width,
+             uint32_t background,
+             uint32_t foreground)
+{
+  if (!width)
+    return XCB_NONE;
+
+  uint16_t height = settings.header_size;
+  xcb_pixmap_t pixmap = xreq_generate_id(conn);
+  xreq_create_pixmap(
+    conn, screen->root_depth, pixmap, screen->root, width, height);
+
+  uint32_t values[] = { background };
+  xreq_change_gc(conn, gc, XCB_GC_FOREGROUND, values);
+  xcb_rectangle_t rect = { 0, 0, width, height };
+  xreq_poly_fill_rectangle(conn, pixmap, gc, 1, &rect);
+
+  // Cut the title where it stops fitting, or where ImageText8 runs out
+  // of length, and mark the cut
+  char buf[TEXT8_MAX];
+  size_t len = text ? strnlen(text, TEXT8_MAX + 1) : 0;
+  bool too_long = len > TEXT8_MAX;
+  int room = width - 2 * TITLE_PADDING;
+  if (too_long)
+    len = TEXT8_MAX;
+  memcpy(buf, text ? text : "", len);
+
+  if (too_long || text_width(buf, len) > room) {
+    int dots = text_width("...", 3);
+    if (len > TEXT8_MAX - 3)
+      len = TEXT8_MAX - 3;
+    while (len && text_width(buf, len) + dots > room)
+      len--;
+    if (len) {
+      memcpy(buf + len, "...", 3);
+      len += 3;
+    }
+  }
+
+  if (len) {
+    uint32_t colors[] = { foreground, background };
+    xreq_change_gc(
+      conn, gc, XCB_GC_FOREGROUND | XCB_GC_BACKGROUND, colors);
+    xreq_image_text_8(conn,
+                      len,
+                      pixmap,
+                      gc,
+                      TITLE_PADDING,
+                      (height + glyphs.ascent - glyphs.descent) / 2,
+                      buf);
+  }
+
+  return pixmap;
+}
@@ -0,0 +1,25 @@
+#ifndef TITLE_H
+#define TITLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <xcb/xcb.h>
+
+// Open the title font and cache its glyph metrics
+void
+title_init(xcb_connection_t* conn, xcb_screen_t* screen);
+
+// Convert a property value to the Latin-1 text the core font draws.
+// Returns a malloc'd string.
+char*
+title_from_property(const char* value, size_t len, bool utf8);
+
+// Render text onto a new header sized pixmap, truncated to fit width.
+// Returns XCB_NONE when there is nothing to render into.
+xcb_pixmap_t
+title_render(const char* text,
+             uint16_t width,
+             uint32_t background,
+             uint32_t foreground);
+
+#endif /* TITLE_H */
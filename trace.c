@@ -0,0 +1,331 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "trace.h"
+#include "utils.h"
+
+#define TRACE_MAGIC "WMT1"
+#define TRACE_SEGMENT (4 << 20) // Bytes mapped at a time while recording
+#define ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+// Every record starts 8 byte aligned with this, followed by the payload
+struct TraceHeader
+{
+  uint32_t size; // Payload bytes, without the padding up to the next record
+  uint32_t type;
+};
+
+struct TraceReply
+{
+  int32_t result;
+  uint32_t reply_size;
+  uint32_t has_error;
+  uint32_t pad;
+};
+
+enum TraceMode trace_mode = TRACE_OFF;
+
+// While recording the current segment, while replaying the whole file
+static int fd = -1;
+static uint8_t* map;
+static size_t map_size;
+static off_t map_offset; // File offset of the segment
+static size_t used;      // Bytes written or read in the map
+
+static const char* type_names[TRACE_TYPE_COUNT] = {
+  [TRACE_PAD] = "padding",
+  [TRACE_SCREEN] = "screen",
+  [TRACE_ID] = "id",
+  [TRACE_EVENT] = "event",
+  [TRACE_NO_EVENT] = "no-event",
+  [TRACE_REPLY] = "reply",
+  [TRACE_EXTENSION] = "extension",
+  [TRACE_COMMAND] = "command",
+  [TRACE_SETTINGS] = "settings",
+};
+
+static bool
+map_segment(size_t size)
+{
+  if (ftruncate(fd, map_offset + size) < 0)
+    return false;
+
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_offset);
+  if (map == MAP_FAILED) {
+    map = NULL;
+    return false;
+  }
+  map_size = size;
+  used = 0;
+  return true;
+}
+
+bool
+trace_record(const char* path)
+{
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    log_error("Failed to create trace %s: %s", path, strerror(errno));
+    return false;
+  }
+
+  map_offset = 0;
+  if (!map_segment(TRACE_SEGMENT)) {
+    log_error("Failed to map trace %s: %s", path, strerror(errno));
+    close(fd);
+    fd = -1;
+    return false;
+  }
+
+  memcpy(map, TRACE_MAGIC, 4);
+  used = 8;
+  trace_mode = TRACE_RECORD;
+  log_info("Recording trace to %s", path);
+  return true;
+}
+
+bool
+trace_replay(const char* path)
+{
+  struct stat st;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < 8) {
+    log_error("Failed to open trace %s", path);
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+    return false;
+  }
+
+  map_size = st.st_size;
+  map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED || memcmp(map, TRACE_MAGIC, 4) != 0) {
+    log_error("Not a trace: %s", path);
+    if (map != MAP_FAILED)
+      munmap(map, map_size);
+    map = NULL;
+    close(fd);
+    fd = -1;
+    return false;
+  }
+
+  used = 8;
+  trace_mode = TRACE_REPLAY;
+  return true;
+}
+
+void
+trace_close(void)
+{
+  if (trace_mode == TRACE_OFF)
+    return;
+
+  if (map)
+    munmap(map, map_size);
+  if (trace_mode == TRACE_RECORD &&
+      ftruncate(fd, map_offset + used) < 0)
+    log_error("Failed to trim trace: %s", strerror(errno));
+  close(fd);
+
+  map = NULL;
+  fd = -1;
+  trace_mode = TRACE_OFF;
+}
+
+// Room for a record in the current segment. Records never straddle
+// segments, a full one is padded out and the next is mapped.
+static uint8_t*
+reserve(enum TraceType type, size_t size)
+{
+  size_t need = sizeof(struct TraceHeader) + ALIGN(size);
+
+  if (used + need > map_size) {
+    if (used < map_size) {
+      struct TraceHeader pad = { map_size - used - sizeof(pad), TRACE_PAD };
+      memcpy(map + used, &pad, sizeof(pad));
+    }
+    munmap(map, map_size);
+    map = NULL;
+    map_offset += map_size;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t segment = TRACE_SEGMENT;
+    if (need > segment)
+      segment = (need + page - 1) / page * page;
+    if (!map_segment(segment)) {
+      // What was recorded so far stays replayable
+      log_error("Trace recording stopped: %s", strerror(errno));
+      used = 0;
+      trace_close();
+      return NULL;
+    }
+  }
+
+  struct TraceHeader header = { size, type };
+  memcpy(map + used, &header, sizeof(header));
+  uint8_t* payload = map + used + sizeof(header);
+  used += need;
+  return payload;
+}
+
+// Header of the next record that is not padding, false at the end
+static bool
+peek(struct TraceHeader* header)
+{
+  while (used + sizeof(*header) <= map_size) {
+    memcpy(header, map + used, sizeof(*header));
+    if (header->type >= TRACE_TYPE_COUNT ||
+        used + sizeof(*header) + header->size > map_size)
+      die("Trace is damaged at offset %zu", used);
+    if (header->type != TRACE_PAD)
+      return true;
+    used += sizeof(*header) + ALIGN(header->size);
+  }
+  return false;
+}
+
+static const uint8_t*
+take(enum TraceType type, size_t* size)
+{
+  struct TraceHeader header;
+
+  if (!peek(&header))
+    die("Trace ended early, expected %s", type_names[type]);
+  if (header.type != type)
+    die("Replay diverged at offset %zu, expected %s but the trace has %s",
+        used,
+        type_names[type],
+        type_names[header.type]);
+
+  const uint8_t* payload = map + used + sizeof(header);
+  used += sizeof(header) + ALIGN(header.size);
+  *size = header.size;
+  return payload;
+}
+
+void
+trace_value(enum TraceType type, void* data, size_t size)
+{
+  if (trace_mode == TRACE_RECORD) {
+    uint8_t* payload = reserve(type, size);
+    if (payload)
+      memcpy(payload, data, size);
+  } else if (trace_mode == TRACE_REPLAY) {
+    size_t recorded;
+    const uint8_t* payload = take(type, &recorded);
+    if (recorded != size)
+      die("Trace %s has %zu bytes instead of %zu",
+          type_names[type],
+          recorded,
+          size);
+    memcpy(data, payload, size);
+  }
+}
+
+bool
+trace_next_is(enum TraceType type)
+{
+  struct TraceHeader header;
+  return trace_mode == TRACE_REPLAY && peek(&header) && header.type == type;
+}
+
+bool
+trace_done(void)
+{
+  struct TraceHeader header;
+  return trace_mode == TRACE_REPLAY && !peek(&header);
+}
+
+void
+trace_event(const xcb_generic_event_t* ev)
+{
+  if (!ev) {
+    reserve(TRACE_NO_EVENT, 0);
+    return;
+  }
+
+  uint8_t* payload = reserve(TRACE_EVENT, 8 + 32);
+  if (!payload)
+    return;
+  uint64_t time = now_ns();
+  memcpy(payload, &time, 8);
+  memcpy(payload + 8, ev, 32);
+}
+
+xcb_generic_event_t*
+trace_replay_event(void)
+{
+  size_t size;
+
+  if (trace_done())
+    return NULL;
+  if (trace_next_is(TRACE_NO_EVENT)) {
+    take(TRACE_NO_EVENT, &size);
+    return NULL;
+  }
+
+  const uint8_t* payload = take(TRACE_EVENT, &size);
+  xcb_generic_event_t* ev = calloc(1, sizeof(*ev));
+  if (!ev)
+    die("Failed to allocate event");
+  memcpy(ev, payload + 8, 32);
+  return ev;
+}
+
+void
+trace_reply(int result, const void* reply, const xcb_generic_error_t* error)
+{
+  struct TraceReply r = { .result = result, .has_error = error != NULL };
+  if (reply)
+    r.reply_size = 32 + 4 * ((const xcb_generic_reply_t*)reply)->length;
+
+  uint8_t* payload =
+    reserve(TRACE_REPLY, sizeof(r) + r.reply_size + (error ? 32 : 0));
+  if (!payload)
+    return;
+
+  memcpy(payload, &r, sizeof(r));
+  if (reply)
+    memcpy(payload + sizeof(r), reply, r.reply_size);
+  if (error)
+    memcpy(payload + sizeof(r) + r.reply_size, error, 32);
+}
+
+int
+trace_replay_reply(void** reply, xcb_generic_error_t** error)
+{
+  size_t size;
+  const uint8_t* payload = take(TRACE_REPLY, &size);
+
+  struct TraceReply r;
+  memcpy(&r, payload, sizeof(r));
+  if (sizeof(r) + r.reply_size + (r.has_error ? 32 : 0) != size)
+    die("Trace reply is damaged at offset %zu", used);
+
+  *reply = NULL;
+  if (r.reply_size) {
+    *reply = malloc(r.reply_size);
+    if (!*reply)
+      die("Failed to allocate reply");
+    memcpy(*reply, payload + sizeof(r), r.reply_size);
+  }
+
+  *error = NULL;
+  if (r.has_error) {
+    *error = calloc(1, sizeof(**error));
+    if (!*error)
+      die("Failed to allocate error");
+    memcpy(*error, payload + sizeof(r) + r.reply_size, 32);
+  }
+
+  return r.result;
+}
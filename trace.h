@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <xcb/xcb.h>
+
+// A trace holds everything the wm took in from the outside world, in the
+// order it took it in: events, replies, generated ids, socket commands
+// and settings. Replaying it drives the same code down the same paths
+// without an X server, requests are simply dropped.
+
+enum TraceMode
+{
+  TRACE_OFF,
+  TRACE_RECORD,
+  TRACE_REPLAY
+};
+
+enum TraceType
+{
+  TRACE_PAD,       // Rest of a segment is unused
+  TRACE_SCREEN,    // xcb_screen_t of the default screen
+  TRACE_ID,        // uint32 from xcb_generate_id
+  TRACE_EVENT,     // uint64 monotonic time, 32 byte event
+  TRACE_NO_EVENT,  // Event queue was empty
+  TRACE_REPLY,     // int32 result, uint32 reply size, reply, error
+  TRACE_EXTENSION, // xcb_query_extension_reply_t, empty if absent
+  TRACE_COMMAND,   // uint32 command, uint32 args[IPC_MAX_ARGS]
+  TRACE_SETTINGS,  // struct Settings
+  TRACE_TYPE_COUNT
+};
+
+extern enum TraceMode trace_mode;
+
+// Start recording to path, returns false on failure
+bool
+trace_record(const char* path);
+
+// Start replaying the trace at path, returns false on failure
+bool
+trace_replay(const char* path);
+
+// Finish the trace file or let go of the replayed one
+void
+trace_close(void);
+
+// Record a value, or fill it in from the next record when replaying.
+// Replaying dies if the trace took another path.
+void
+trace_value(enum TraceType type, void* data, size_t size);
+
+// Whether the replay has a record of type next
+bool
+trace_next_is(enum TraceType type);
+
+// Whether the replay has used up every record
+bool
+trace_done(void);
+
+// Record an event as received, NULL for an empty queue
+void
+trace_event(const xcb_generic_event_t* ev);
+
+// Next event of the replay, NULL where the queue was empty
+xcb_generic_event_t*
+trace_replay_event(void);
+
+// Record the outcome of fetching a reply
+void
+trace_reply(int result, const void* reply, const xcb_generic_error_t* error);
+
+// Outcome of fetching a reply in the replay. The caller frees reply and
+// error like ones from xcb.
+int
+trace_replay_reply(void** reply, xcb_generic_error_t** error);
+
+#endif /* TRACE_H */
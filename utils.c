@@ -3,31 +3,23 @@
 #include <stdlib.h>
 #include <time.h>
 
+#include "log.h"
 #include "utils.h"
 
-static int debug_enabled = 1;
-
-void
-debug(const char* fmt, ...)
+uint64_t
+now_ns(void)
 {
-  if (!debug_enabled)
-    return;
-
-  time_t now = time(NULL);
-  char timestamp[64];
-  strftime(timestamp, sizeof(timestamp), "%H:%M:%S", localtime(&now));
-
-  va_list ap;
-  va_start(ap, fmt);
-  fprintf(stderr, "[%s] ", timestamp);
-  vfprintf(stderr, fmt, ap);
-  fprintf(stderr, "\n");
-  va_end(ap);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
 void
 die(const char* fmt, ...)
 {
+  // Queued log records explain what led here
+  log_stop();
+
   va_list ap;
   va_start(ap, fmt);
   fprintf(stderr, "Error: ");
@@ -2,10 +2,11 @@
 #define UTILS_H
 
 #include <stdarg.h>
+#include <stdint.h>
 
-// Print debug message with timestamp
-void
-debug(const char* fmt, ...);
+// Monotonic clock in nanoseconds
+uint64_t
+now_ns(void);
 
 // Print error message and exit
 void
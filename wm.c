@@ -1,23 +1,49 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 #include <xcb/xcb.h>
 
 #include "config.h"
 #include "ipc.h"
+#include "layout.h"
+#include "log.h"
+#include "output.h"
+#include "query.h"
+#include "server.h"
+#include "settings.h"
+#include "stats.h"
+#include "title.h"
+#include "trace.h"
 #include "utils.h"
+#include "wm.h"
+#include "xreq.h"
 
-enum WindowState
+// Server side attributes of one X window
+struct SceneState
 {
-  STATE_NORMAL,
-  STATE_FULLSCREEN,
-  STATE_SNAPPED_LEFT,
-  STATE_SNAPPED_RIGHT,
-  STATE_MAXIMIZED
+  int16_t x, y;
+  uint16_t width, height;
+  uint16_t border_width;
+  uint32_t border_color; // Frames only
+  uint32_t background;   // Headers only
+  xcb_pixmap_t background_pixmap; // Headers only, drawn over background
+  bool mapped;
+};
+
+// Handlers only change want, commit_scene() sends whatever differs from
+// what was last sent
+struct SceneNode
+{
+  struct SceneState want;
+  struct SceneState sent;
 };
 
 struct Window
@@ -25,24 +51,76 @@ struct Window
   xcb_window_t id;        // Original window
   xcb_window_t frame;     // Frame containing header + window
   xcb_window_t header;    // Header window
-  int16_t x, y;           // Position
-  uint16_t width, height; // Dimensions
+  int16_t x, y;           // Frame position
+  uint16_t width, height; // Frame size, header included
   enum WindowState state; // Window state
+  int workspace;          // Workspace the window belongs to
   struct
   {
     int16_t x, y;
     uint16_t width, height;
   } saved;             // Saved position/dimensions
-  struct Window* next; // Next window in list
+  struct Window* next; // Next window in workspace (or free list)
+  struct Window* prev; // Previous window in workspace
+  struct
+  {
+    struct SceneNode frame, header, client;
+    bool queued; // Listed in dirty_scenes
+  } scene;
+  struct
+  {
+    char* text;              // NULL until the name is known
+    bool dirty;              // Text changed since the pixmaps were drawn
+    bool focused;            // Which pixmap the header shows
+    uint16_t width;          // Header width the pixmaps were drawn for
+    xcb_pixmap_t pixmaps[2]; // Unfocused and focused header
+  } title;
 };
 
 struct Workspace
 {
-  struct Window* windows;
+  struct Window* windows; // First window, in creation order
+  struct Window* last;    // Last window
   int window_count;
   struct Window* focused;
+  xcb_window_t container; // Parent of the frames, shown while visible
+  int output;             // Output showing the workspace, -1 if hidden
+  struct Rect area;       // Container geometry while shown, root coordinates
+  struct Rect placed;     // Container geometry last sent
+  enum Layout layout;
+  bool layout_dirty; // Tiled windows need to be arranged again
+};
+
+// Window records are carved out of slabs and never move, so pointers to
+// them stay valid until window_delete()
+#define WINDOW_SLAB_SIZE 64
+
+struct WindowSlab
+{
+  struct WindowSlab* next;
+  struct Window windows[WINDOW_SLAB_SIZE];
+};
+
+struct
+{
+  struct WindowSlab* slabs;
+  struct Window* free; // Free records linked through next
+} window_pool = { 0 };
+
+// Maps client, frame and header ids to their window record
+struct WindowIndexEntry
+{
+  xcb_window_t id; // XCB_NONE marks an empty slot
+  struct Window* win;
 };
 
+struct
+{
+  struct WindowIndexEntry* entries;
+  unsigned int bits; // log2 of the table size
+  unsigned int count;
+} window_index = { 0 };
+
 struct
 {
   struct Window* window; // Window being dragged (NULL if not dragging)
@@ -50,25 +128,266 @@ struct
   int16_t orig_y;        // Original window Y position
   int16_t press_x;       // Mouse X position when button was pressed
   int16_t press_y;       // Mouse Y position when button was pressed
+  int16_t motion_x;      // Newest pending mouse X position
+  int16_t motion_y;      // Newest pending mouse Y position
+  bool motion_pending;   // Motion received but not applied yet
+  uint64_t motion_time;  // When motion was last applied (ns)
 } drag_state = { 0 };
 
+struct PendingConfigure
+{
+  xcb_window_t window;
+  uint16_t value_mask; // Union of all coalesced request masks
+  int16_t x, y;
+  uint16_t width, height;
+  uint16_t border_width;
+  xcb_window_t sibling;
+  uint8_t stack_mode;
+};
+
+struct
+{
+  struct PendingConfigure* items;
+  int count;
+  int capacity;
+} pending_configures = { 0 };
+
+// Map request waiting for its replies before the window can be framed
+struct PendingMap
+{
+  xcb_window_t window; // XCB_NONE once the window is destroyed
+  xcb_get_geometry_cookie_t geometry;
+};
+
+struct
+{
+  struct PendingMap* items; // In request order
+  int count;
+  int capacity;
+} pending_maps = { 0 };
+
+// Windows whose scene changed since the last commit
+struct
+{
+  struct Window** items; // NULL once the window is deleted
+  int count;
+  int capacity;
+} dirty_scenes = { 0 };
+
+// Name properties requested for a window, read once both replies are in
+struct PendingTitle
+{
+  xcb_window_t window;
+  xcb_get_property_cookie_t net_name;
+  xcb_get_property_cookie_t name;
+};
+
+struct
+{
+  struct PendingTitle* items; // In request order
+  int count;
+  int capacity;
+} pending_titles = { 0 };
+
+typedef int (*CommandHandler)(const uint32_t* args);
+
+// Open addressing table from command atom to command id
+#define COMMAND_LOOKUP_SIZE 64
+
+struct
+{
+  xcb_atom_t atom; // XCB_NONE marks an empty slot
+  int command;
+} command_lookup[COMMAND_LOOKUP_SIZE] = { 0 };
+
+struct
+{
+  unsigned long batches; // Event batches dispatched
+  unsigned long events;  // Events dispatched
+  unsigned long flushes; // Output buffer flushes
+  unsigned long merged;  // Events folded into an already pending one
+} loop_stats = { 0 };
+
 static xcb_connection_t* conn;
 static xcb_screen_t* screen;
-static xcb_atom_t kill_command_atom;
-static xcb_atom_t move_command_atom;
-static xcb_atom_t resize_command_atom;
-static xcb_atom_t focus_next_command_atom;
-static xcb_atom_t focus_prev_command_atom;
-static xcb_atom_t snap_left_command_atom;
-static xcb_atom_t snap_right_command_atom;
-static xcb_atom_t maximize_command_atom;
-static xcb_atom_t fullscreen_command_atom;
-static xcb_atom_t switch_workspace_command_atom;
-static xcb_atom_t send_to_workspace_command_atom;
-static xcb_atom_t quit_command_atom;
+static char* program_path;
+static bool running = true;
+static bool snapshot_dirty = true; // Model changed since the last snapshot
+static bool restart_requested = false;
+static int settings_fd = -1;         // Watches the config file
+static bool settings_pending = false; // Config file changed, not applied yet
+static xcb_atom_t command_atoms[COMMAND_COUNT];
+static xcb_atom_t net_wm_name_atom;
+static xcb_atom_t utf8_string_atom;
 static struct Workspace workspaces[MAX_WORKSPACES] = { 0 };
 static int current_workspace = 0;
 
+static unsigned int
+window_index_slot(xcb_window_t id)
+{
+  // Fibonacci hashing, XIDs are sequential within a client
+  return (id * 2654435761u) >> (32 - window_index.bits);
+}
+
+static void
+window_index_put(xcb_window_t id, struct Window* win)
+{
+  // Keep the load factor at or below one half
+  if (!window_index.bits ||
+      (window_index.count + 1) * 2 > (1u << window_index.bits)) {
+    struct WindowIndexEntry* old = window_index.entries;
+    unsigned int old_size = old ? 1u << window_index.bits : 0;
+
+    window_index.bits = window_index.bits ? window_index.bits + 1 : 6;
+    window_index.entries =
+      calloc(1u << window_index.bits, sizeof(struct WindowIndexEntry));
+    if (!window_index.entries)
+      die("Failed to allocate window index");
+    window_index.count = 0;
+
+    for (unsigned int i = 0; i < old_size; i++) {
+      if (old[i].id != XCB_NONE)
+        window_index_put(old[i].id, old[i].win);
+    }
+    free(old);
+  }
+
+  unsigned int mask = (1u << window_index.bits) - 1;
+  unsigned int slot = window_index_slot(id);
+  while (window_index.entries[slot].id != XCB_NONE &&
+         window_index.entries[slot].id != id)
+    slot = (slot + 1) & mask;
+
+  if (window_index.entries[slot].id == XCB_NONE)
+    window_index.count++;
+
+  window_index.entries[slot].id = id;
+  window_index.entries[slot].win = win;
+}
+
+static void
+window_index_remove(xcb_window_t id)
+{
+  if (!window_index.count)
+    return;
+
+  unsigned int mask = (1u << window_index.bits) - 1;
+  unsigned int slot = window_index_slot(id);
+  while (window_index.entries[slot].id != id) {
+    if (window_index.entries[slot].id == XCB_NONE)
+      return;
+    slot = (slot + 1) & mask;
+  }
+
+  // Shift later entries of the probe run back instead of leaving tombstones
+  unsigned int hole = slot;
+  for (;;) {
+    slot = (slot + 1) & mask;
+    if (window_index.entries[slot].id == XCB_NONE)
+      break;
+
+    unsigned int home = window_index_slot(window_index.entries[slot].id);
+    if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+      window_index.entries[hole] = window_index.entries[slot];
+      hole = slot;
+    }
+  }
+
+  window_index.entries[hole].id = XCB_NONE;
+  window_index.entries[hole].win = NULL;
+  window_index.count--;
+}
+
+static void
+window_index_add(struct Window* win)
+{
+  window_index_put(win->id, win);
+  window_index_put(win->frame, win);
+  window_index_put(win->header, win);
+}
+
+static struct Window*
+window_alloc(void)
+{
+  if (!window_pool.free) {
+    struct WindowSlab* slab = malloc(sizeof(struct WindowSlab));
+    if (!slab)
+      die("Failed to allocate window records");
+
+    slab->next = window_pool.slabs;
+    window_pool.slabs = slab;
+
+    for (int i = WINDOW_SLAB_SIZE - 1; i >= 0; i--) {
+      slab->windows[i].next = window_pool.free;
+      window_pool.free = &slab->windows[i];
+    }
+  }
+
+  struct Window* win = window_pool.free;
+  window_pool.free = win->next;
+  memset(win, 0, sizeof(*win));
+
+  return win;
+}
+
+static void
+window_free(struct Window* win)
+{
+  win->next = window_pool.free;
+  window_pool.free = win;
+}
+
+static void
+workspace_append(int workspace, struct Window* win)
+{
+  struct Workspace* ws = &workspaces[workspace];
+
+  win->workspace = workspace;
+  win->next = NULL;
+  win->prev = ws->last;
+  if (ws->last)
+    ws->last->next = win;
+  else
+    ws->windows = win;
+  ws->last = win;
+  ws->window_count++;
+  ws->layout_dirty = true;
+}
+
+static void
+workspace_remove(struct Window* win)
+{
+  struct Workspace* ws = &workspaces[win->workspace];
+
+  if (win == ws->focused) {
+    ws->focused = NULL;
+  }
+
+  if (win->prev)
+    win->prev->next = win->next;
+  else
+    ws->windows = win->next;
+  if (win->next)
+    win->next->prev = win->prev;
+  else
+    ws->last = win->prev;
+  ws->window_count--;
+  ws->layout_dirty = true;
+
+  win->next = win->prev = NULL;
+}
+
+// Tell event subscribers about a change, which queries will also see
+static void
+publish(int type, int workspace, xcb_window_t window, uint32_t value)
+{
+  struct IpcEvent ev = {
+    .type = type, .workspace = workspace, .window = window, .value = value
+  };
+  server_publish(&ev);
+  snapshot_dirty = true;
+}
+
 static struct Window*
 window_create(xcb_window_t id,
               xcb_window_t frame,
@@ -78,10 +397,7 @@ window_create(xcb_window_t id,
               uint16_t width,
               uint16_t height)
 {
-  struct Workspace* ws = &workspaces[current_workspace];
-  ws->windows =
-    realloc(ws->windows, sizeof(struct Window) * (ws->window_count + 1));
-  struct Window* win = &ws->windows[ws->window_count++];
+  struct Window* win = window_alloc();
 
   win->id = id;
   win->frame = frame;
@@ -92,39 +408,54 @@ window_create(xcb_window_t id,
   win->height = height;
   win->state = STATE_NORMAL;
 
+  workspace_append(current_workspace, win);
+  window_index_add(win);
+
   return win;
 }
 
 static struct Window*
 window_find(xcb_window_t id)
 {
-  struct Workspace* ws = &workspaces[current_workspace];
-  for (int i = 0; i < ws->window_count; i++) {
-    if (ws->windows[i].id == id || ws->windows[i].frame == id ||
-        ws->windows[i].header == id)
-      return &ws->windows[i];
+  if (!window_index.count)
+    return NULL;
+
+  unsigned int mask = (1u << window_index.bits) - 1;
+  unsigned int slot = window_index_slot(id);
+  while (window_index.entries[slot].id != XCB_NONE) {
+    if (window_index.entries[slot].id == id)
+      return window_index.entries[slot].win;
+    slot = (slot + 1) & mask;
   }
   return NULL;
 }
 
 static void
-window_delete(xcb_window_t id)
+window_delete(struct Window* win)
 {
-  struct Workspace* ws = &workspaces[current_workspace];
-  for (int i = 0; i < ws->window_count; i++) {
-    if (ws->windows[i].id == id) {
-      if (&ws->windows[i] == ws->focused) {
-        ws->focused = NULL;
-      }
-      memmove(&ws->windows[i],
-              &ws->windows[i + 1],
-              sizeof(struct Window) * (ws->window_count - i - 1));
-      ws->window_count--;
-      ws->windows =
-        realloc(ws->windows, sizeof(struct Window) * ws->window_count);
-      return;
+  bool focused = win == workspaces[win->workspace].focused;
+
+  publish(IPC_EVENT_DESTROY, win->workspace, win->id, 0);
+  if (focused && win->workspace == current_workspace)
+    publish(IPC_EVENT_FOCUS, current_workspace, XCB_NONE, 0);
+
+  window_index_remove(win->id);
+  window_index_remove(win->frame);
+  window_index_remove(win->header);
+  workspace_remove(win);
+
+  if (win == drag_state.window) {
+    drag_state.window = NULL;
+  }
+
+  if (win->scene.queued) {
+    for (int i = 0; i < dirty_scenes.count; i++) {
+      if (dirty_scenes.items[i] == win)
+        dirty_scenes.items[i] = NULL;
     }
   }
+
+  window_free(win);
 }
 
 static void
@@ -149,39 +480,82 @@ restore_window_state(struct Window* win)
 }
 
 static void
-focus_window(struct Window* win)
+scene_queue(struct Window* win)
 {
-  struct Workspace* ws = &workspaces[current_workspace];
-  if (win == ws->focused)
+  if (win->scene.queued)
     return;
 
-  // Update colors for all windows in current workspace
-  for (int i = 0; i < ws->window_count; i++) {
-    uint32_t header_color =
-      (win == &ws->windows[i]) ? FOCUSED_HEADER_COLOR : UNFOCUSED_HEADER_COLOR;
-    uint32_t border_color =
-      (win == &ws->windows[i]) ? FOCUSED_BORDER_COLOR : UNFOCUSED_BORDER_COLOR;
-
-    uint32_t values[] = { header_color };
-    xcb_change_window_attributes(
-      conn, ws->windows[i].header, XCB_CW_BACK_PIXEL, values);
+  if (dirty_scenes.count == dirty_scenes.capacity) {
+    dirty_scenes.capacity =
+      dirty_scenes.capacity ? dirty_scenes.capacity * 2 : 16;
+    dirty_scenes.items = realloc(
+      dirty_scenes.items, sizeof(struct Window*) * dirty_scenes.capacity);
+    if (!dirty_scenes.items)
+      die("Failed to allocate scene queue");
+  }
 
-    values[0] = border_color;
-    xcb_change_window_attributes(
-      conn, ws->windows[i].frame, XCB_CW_BORDER_PIXEL, values);
+  dirty_scenes.items[dirty_scenes.count++] = win;
+  win->scene.queued = true;
+}
 
-    xcb_clear_area(conn, 0, ws->windows[i].header, 0, 0, 0, 0);
+static void
+free_title_pixmaps(struct Window* win)
+{
+  for (int i = 0; i < 2; i++) {
+    if (win->title.pixmaps[i] != XCB_NONE)
+      xreq_free_pixmap(conn, win->title.pixmaps[i]);
+    win->title.pixmaps[i] = XCB_NONE;
   }
+}
+
+static void
+paint_window(struct Window* win, bool focused)
+{
+  // Switching focus only swaps the pre-rendered header pixmaps
+  win->title.focused = focused;
+  win->scene.header.want.background_pixmap = win->title.pixmaps[focused];
+  win->scene.header.want.background =
+    focused ? settings.focused_header_color : settings.unfocused_header_color;
+  win->scene.frame.want.border_color =
+    focused ? settings.focused_border_color : settings.unfocused_border_color;
+  scene_queue(win);
+}
+
+static void
+focus_window(struct Window* win)
+{
+  struct Workspace* ws = &workspaces[current_workspace];
+  if (win == ws->focused)
+    return;
+
+  // Only the previously and newly focused windows change colors
+  if (ws->focused)
+    paint_window(ws->focused, false);
 
-  // Raise focused window
   if (win) {
+    paint_window(win, true);
+
+    // Raise focused window
     uint32_t values[] = { XCB_STACK_MODE_ABOVE };
-    xcb_configure_window(
+    xreq_configure_window(
       conn, win->frame, XCB_CONFIG_WINDOW_STACK_MODE, values);
   }
 
   ws->focused = win;
-  xcb_flush(conn);
+  publish(IPC_EVENT_FOCUS, current_workspace, win ? win->id : XCB_NONE, 0);
+}
+
+static void
+move_window(struct Window* win, int16_t x, int16_t y)
+{
+  snapshot_dirty = true;
+
+  win->x = x;
+  win->y = y;
+
+  win->scene.frame.want.x = x;
+  win->scene.frame.want.y = y;
+  scene_queue(win);
 }
 
 static void
@@ -192,141 +566,241 @@ resize_window(struct Window* win,
               uint16_t height,
               bool show_decorations)
 {
+  snapshot_dirty = true;
+
+  // The border is drawn outside the frame, the client fills the rest
+  int header_size = show_decorations ? settings.header_size : 0;
+  int border_size = show_decorations ? settings.border_size : 0;
+
+  // A header reloaded taller than the frame grows it, leaving the client
+  // at least a pixel
+  if (height <= header_size)
+    height = header_size + 1;
+  if (!width)
+    width = 1;
+
   win->x = x;
   win->y = y;
   win->width = width;
   win->height = height;
 
-  // Configure the frame window
-  uint32_t frame_vals[] = {
-    win->x, win->y, win->width, win->height, show_decorations ? BORDER_SIZE : 0
-  };
-  xcb_configure_window(conn,
-                       win->frame,
-                       XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
-                         XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT |
-                         XCB_CONFIG_WINDOW_BORDER_WIDTH,
-                       frame_vals);
-
-  // Configure the header window
-  if (show_decorations) {
-    xcb_map_window(conn, win->header);
-    uint32_t header_vals[] = { 0, 0, win->width, HEADER_SIZE };
-    xcb_configure_window(conn,
-                         win->header,
-                         XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
-                           XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT,
-                         header_vals);
-  } else {
-    xcb_unmap_window(conn, win->header);
+  struct SceneState* frame = &win->scene.frame.want;
+  frame->x = x;
+  frame->y = y;
+  frame->width = width;
+  frame->height = height;
+  frame->border_width = border_size;
+
+  struct SceneState* header = &win->scene.header.want;
+  header->x = 0;
+  header->y = 0;
+  header->width = width;
+  header->height = settings.header_size;
+  header->mapped = show_decorations;
+
+  struct SceneState* client = &win->scene.client.want;
+  client->x = 0;
+  client->y = header_size;
+  client->width = width;
+  client->height = height - header_size;
+
+  scene_queue(win);
+}
+
+// Usable area of a workspace, in the coordinates of its container
+static struct Rect
+workspace_area(int workspace)
+{
+  struct Rect area = workspaces[workspace].area;
+  return (struct Rect){ 0, 0, area.width, area.height };
+}
+
+// Show a workspace on an output, or hide it with output -1, through its
+// container at the same cost however many windows it holds
+static void
+show_workspace(int workspace, int output)
+{
+  struct Workspace* ws = &workspaces[workspace];
+  ws->output = output;
+
+  struct Rect target = ws->area;
+  if (output >= 0) {
+    target = output_area(output);
+    if (target.width != ws->area.width || target.height != ws->area.height)
+      ws->layout_dirty = true;
+    ws->area = target;
+  } else if (WORKSPACE_PARKING) {
+    // Parked containers stay mapped, left of the root window
+    target.x = -target.width;
   }
 
-  // Configure the client window
-  uint32_t client_vals[] = {
-    0,
-    show_decorations ? HEADER_SIZE : 0,
-    win->width - (show_decorations ? 2 * BORDER_SIZE : 0),
-    win->height - (show_decorations ? HEADER_SIZE + 2 * BORDER_SIZE : 0)
-  };
-  xcb_configure_window(conn,
-                       win->id,
-                       XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
-                         XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT,
-                       client_vals);
+  if (memcmp(&target, &ws->placed, sizeof(target)) != 0) {
+    uint32_t values[] = { target.x, target.y, target.width, target.height };
+    xreq_configure_window(conn,
+                          ws->container,
+                          XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                            XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT,
+                          values);
+    ws->placed = target;
+  }
 
-  xcb_flush(conn);
+  if (WORKSPACE_PARKING)
+    return;
+  if (output >= 0)
+    xreq_map_window(conn, ws->container);
+  else
+    xreq_unmap_window(conn, ws->container);
 }
 
+// Give every output a workspace. Outputs that still exist keep theirs,
+// and the current workspace always stays visible.
 static void
-switch_to_workspace(int workspace)
+assign_outputs(void)
 {
-  if (workspace < 0 || workspace >= MAX_WORKSPACES ||
-      workspace == current_workspace) {
-    return;
+  int count = output_count();
+  int shown[OUTPUT_MAX];
+  int target[MAX_WORKSPACES];
+
+  for (int i = 0; i < OUTPUT_MAX; i++)
+    shown[i] = -1;
+  for (int i = 0; i < MAX_WORKSPACES; i++)
+    target[i] = -1;
+
+  // The current workspace claims its output first
+  for (int k = -1; k < MAX_WORKSPACES; k++) {
+    int i = k < 0 ? current_workspace : k;
+    int output = workspaces[i].output;
+    if (output >= 0 && output < count && shown[output] < 0) {
+      shown[output] = i;
+      target[i] = output;
+    }
   }
 
-  // Hide all windows in current workspace
-  for (int i = 0; i < workspaces[current_workspace].window_count; i++) {
-    xcb_unmap_window(conn, workspaces[current_workspace].windows[i].frame);
+  if (target[current_workspace] < 0) {
+    int output = 0;
+    while (output < count - 1 && shown[output] >= 0)
+      output++;
+    if (shown[output] >= 0)
+      target[shown[output]] = -1;
+    shown[output] = current_workspace;
+    target[current_workspace] = output;
   }
 
-  current_workspace = workspace;
-
-  // Show all windows in target workspace
-  for (int i = 0; i < workspaces[current_workspace].window_count; i++) {
-    xcb_map_window(conn, workspaces[current_workspace].windows[i].frame);
+  // Remaining outputs show the lowest hidden workspaces
+  for (int output = 0; output < count; output++) {
+    for (int i = 0; shown[output] < 0 && i < MAX_WORKSPACES; i++) {
+      if (target[i] < 0) {
+        shown[output] = i;
+        target[i] = output;
+      }
+    }
   }
 
+  for (int i = 0; i < MAX_WORKSPACES; i++)
+    show_workspace(i, target[i]);
+}
+
+static void
+set_current_workspace(int workspace)
+{
+  publish(IPC_EVENT_WORKSPACE, workspace, XCB_NONE, current_workspace);
+  current_workspace = workspace;
+
   // Restore focused window
   if (workspaces[current_workspace].focused) {
     focus_window(workspaces[current_workspace].focused);
   }
 
-  xcb_flush(conn);
+  struct Window* focused = workspaces[current_workspace].focused;
+  publish(IPC_EVENT_FOCUS,
+          current_workspace,
+          focused ? focused->id : XCB_NONE,
+          0);
 }
 
 static void
-send_window_to_workspace(struct Window* win, int workspace)
+switch_to_workspace(int workspace)
 {
-  if (!win || workspace < 0 || workspace >= MAX_WORKSPACES ||
+  if (workspace < 0 || workspace >= MAX_WORKSPACES ||
       workspace == current_workspace) {
     return;
   }
 
-  // Add window to target workspace
-  struct Workspace* target = &workspaces[workspace];
-  target->windows = realloc(target->windows,
-                            sizeof(struct Window) * (target->window_count + 1));
-  target->windows[target->window_count++] = *win;
+  // A workspace visible on another output trades places with the current
+  // one. The target is shown first so the root never shows through.
+  int output = workspaces[current_workspace].output;
+  int other = workspaces[workspace].output;
+  show_workspace(workspace, output);
+  show_workspace(current_workspace, other);
 
-  // Hide window
-  xcb_unmap_window(conn, win->frame);
+  set_current_workspace(workspace);
+}
 
-  // Remove from current workspace
-  window_delete(win->id);
+static void
+send_window_to_workspace(struct Window* win, int workspace)
+{
+  if (!win || workspace < 0 || workspace >= MAX_WORKSPACES ||
+      workspace == current_workspace) {
+    return;
+  }
 
-  xcb_flush(conn);
+  // Move the frame into the hidden target container, it arrives
+  // unfocused there
+  xreq_reparent_window(conn,
+                       win->frame,
+                       workspaces[workspace].container,
+                       win->scene.frame.sent.x,
+                       win->scene.frame.sent.y);
+  bool focused = win == workspaces[win->workspace].focused;
+  if (focused)
+    paint_window(win, false);
+
+  // Relink the record, its index entries stay valid
+  workspace_remove(win);
+  workspace_append(workspace, win);
+
+  publish(IPC_EVENT_SEND, workspace, win->id, 0);
+  if (focused)
+    publish(IPC_EVENT_FOCUS, current_workspace, XCB_NONE, 0);
 }
 
-static void
-handle_kill_window()
+static int
+handle_kill_window(const uint32_t* args)
 {
+  (void)args;
+
   struct Window* focused_window = workspaces[current_workspace].focused;
-  if (focused_window) {
-    xcb_kill_client(conn, focused_window->id);
-    xcb_flush(conn);
-  }
+  if (!focused_window)
+    return IPC_ERR_NO_WINDOW;
+
+  xreq_kill_client(conn, focused_window->id);
+  return IPC_OK;
 }
 
-static void
-handle_move_window(xcb_client_message_event_t* ev)
+static int
+handle_move_window(const uint32_t* args)
 {
   struct Window* focused_window = workspaces[current_workspace].focused;
-  if (focused_window) {
-    int16_t dx = ev->data.data32[0];
-    int16_t dy = ev->data.data32[1];
+  if (!focused_window)
+    return IPC_ERR_NO_WINDOW;
 
-    focused_window->x += dx;
-    focused_window->y += dy;
+  int16_t dx = args[0];
+  int16_t dy = args[1];
 
-    uint32_t values[2] = { focused_window->x, focused_window->y };
-    xcb_configure_window(conn,
-                         focused_window->frame,
-                         XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y,
-                         values);
-    xcb_flush(conn);
-  }
+  move_window(
+    focused_window, focused_window->x + dx, focused_window->y + dy);
+  return IPC_OK;
 }
 
-static void
-handle_resize_window(xcb_client_message_event_t* ev)
+static int
+handle_resize_window(const uint32_t* args)
 {
   struct Window* focused_window = workspaces[current_workspace].focused;
   if (!focused_window)
-    return;
+    return IPC_ERR_NO_WINDOW;
 
-  int16_t dx = ev->data.data32[0];
-  int16_t dy = ev->data.data32[1];
+  int16_t dx = args[0];
+  int16_t dy = args[1];
 
   resize_window(focused_window,
                 focused_window->x,
@@ -334,6 +808,7 @@ handle_resize_window(xcb_client_message_event_t* ev)
                 focused_window->width + dx,
                 focused_window->height + dy,
                 true);
+  return IPC_OK;
 }
 
 static void
@@ -344,39 +819,62 @@ focus_window_relative(int direction)
     return;
 
   if (!ws->focused) {
-    focus_window(&ws->windows[0]);
+    focus_window(ws->windows);
     return;
   }
 
-  // Find current window index
-  int current = 0;
-  for (int i = 0; i < ws->window_count; i++) {
-    if (&ws->windows[i] == ws->focused) {
-      current = i;
-      break;
-    }
-  }
+  // Step through the list with wrap-around
+  struct Window* next;
+  if (direction > 0)
+    next = ws->focused->next ? ws->focused->next : ws->windows;
+  else
+    next = ws->focused->prev ? ws->focused->prev : ws->last;
 
-  // Calculate new index with wrap-around
-  int new_index = (current + direction + ws->window_count) % ws->window_count;
-  focus_window(&ws->windows[new_index]);
+  focus_window(next);
 }
 
-static void
-handle_toggle_snap_left(void)
+static int
+handle_focus_next(const uint32_t* args)
+{
+  (void)args;
+
+  if (!workspaces[current_workspace].window_count)
+    return IPC_ERR_NO_WINDOW;
+
+  focus_window_relative(1);
+  return IPC_OK;
+}
+
+static int
+handle_focus_prev(const uint32_t* args)
 {
+  (void)args;
+
+  if (!workspaces[current_workspace].window_count)
+    return IPC_ERR_NO_WINDOW;
+
+  focus_window_relative(-1);
+  return IPC_OK;
+}
+
+static int
+handle_toggle_snap_left(const uint32_t* args)
+{
+  (void)args;
+
   struct Window* focused_window = workspaces[current_workspace].focused;
   if (!focused_window)
-    return;
+    return IPC_ERR_NO_WINDOW;
 
   if (focused_window->state != STATE_SNAPPED_LEFT) {
     save_window_state(focused_window);
     focused_window->state = STATE_SNAPPED_LEFT;
+    struct Rect area = workspace_area(current_workspace);
     resize_window(focused_window,
-                  0,
-                  0,
-                  screen->width_in_pixels / 2,
-                  screen->height_in_pixels,
+                  area.x,
+                  area.y,
+                  area.width / 2,
+                  area.height,
                   true);
   } else {
     restore_window_state(focused_window);
@@ -387,23 +885,35 @@ handle_toggle_snap_left(void)
                   focused_window->height,
                   true);
   }
+
+  // The window joins or leaves the tiled windows
+  workspaces[current_workspace].layout_dirty = true;
+
+  publish(IPC_EVENT_STATE,
+          current_workspace,
+          focused_window->id,
+          focused_window->state);
+  return IPC_OK;
 }
 
-static void
-handle_toggle_snap_right(void)
+static int
+handle_toggle_snap_right(const uint32_t* args)
 {
+  (void)args;
+
   struct Window* focused_window = workspaces[current_workspace].focused;
   if (!focused_window)
-    return;
+    return IPC_ERR_NO_WINDOW;
 
   if (focused_window->state != STATE_SNAPPED_RIGHT) {
     save_window_state(focused_window);
     focused_window->state = STATE_SNAPPED_RIGHT;
+    struct Rect area = workspace_area(current_workspace);
     resize_window(focused_window,
-                  screen->width_in_pixels / 2,
-                  0,
-                  screen->width_in_pixels / 2,
-                  screen->height_in_pixels,
+                  area.x + area.width / 2,
+                  area.y,
+                  area.width - area.width / 2,
+                  area.height,
                   true);
   } else {
     restore_window_state(focused_window);
@@ -414,24 +924,32 @@ handle_toggle_snap_right(void)
                   focused_window->height,
                   true);
   }
+
+  // The window joins or leaves the tiled windows
+  workspaces[current_workspace].layout_dirty = true;
+
+  publish(IPC_EVENT_STATE,
+          current_workspace,
+          focused_window->id,
+          focused_window->state);
+  return IPC_OK;
 }
 
-static void
-handle_toggle_maximize(void)
+static int
+handle_toggle_maximize(const uint32_t* args)
 {
+  (void)args;
+
   struct Window* focused_window = workspaces[current_workspace].focused;
   if (!focused_window)
-    return;
+    return IPC_ERR_NO_WINDOW;
 
   if (focused_window->state != STATE_MAXIMIZED) {
     save_window_state(focused_window);
     focused_window->state = STATE_MAXIMIZED;
-    resize_window(focused_window,
-                  0,
-                  0,
-                  screen->width_in_pixels,
-                  screen->height_in_pixels,
-                  true);
+    struct Rect area = workspace_area(current_workspace);
+    resize_window(
+      focused_window, area.x, area.y, area.width, area.height, true);
   } else {
     restore_window_state(focused_window);
     resize_window(focused_window,
@@ -441,24 +959,32 @@ handle_toggle_maximize(void)
                   focused_window->height,
                   true);
   }
+
+  // The window joins or leaves the tiled windows
+  workspaces[current_workspace].layout_dirty = true;
+
+  publish(IPC_EVENT_STATE,
+          current_workspace,
+          focused_window->id,
+          focused_window->state);
+  return IPC_OK;
 }
 
-static void
-handle_toggle_fullscreen(void)
+static int
+handle_toggle_fullscreen(const uint32_t* args)
 {
+  (void)args;
+
   struct Window* focused_window = workspaces[current_workspace].focused;
   if (!focused_window)
-    return;
+    return IPC_ERR_NO_WINDOW;
 
   if (focused_window->state != STATE_FULLSCREEN) {
     save_window_state(focused_window);
     focused_window->state = STATE_FULLSCREEN;
-    resize_window(focused_window,
-                  0,
-                  0,
-                  screen->width_in_pixels,
-                  screen->height_in_pixels,
-                  false);
+    struct Rect area = workspace_area(current_workspace);
+    resize_window(
+      focused_window, area.x, area.y, area.width, area.height, false);
   } else {
     restore_window_state(focused_window);
     resize_window(focused_window,
@@ -468,172 +994,530 @@ handle_toggle_fullscreen(void)
                   focused_window->height,
                   true);
   }
+
+  // The window joins or leaves the tiled windows
+  workspaces[current_workspace].layout_dirty = true;
+
+  publish(IPC_EVENT_STATE,
+          current_workspace,
+          focused_window->id,
+          focused_window->state);
+  return IPC_OK;
 }
 
-static void
-handle_switch_workspace(xcb_client_message_event_t* ev)
+static int
+handle_set_layout(const uint32_t* args)
 {
-  int workspace = ev->data.data32[0];
-  switch_to_workspace(workspace);
+  int layout = args[0];
+  if (layout < 0 || layout >= LAYOUT_COUNT)
+    return IPC_ERR_LAYOUT;
+
+  workspaces[current_workspace].layout = layout;
+  workspaces[current_workspace].layout_dirty = true;
+  return IPC_OK;
 }
 
-static void
-handle_send_to_workspace(xcb_client_message_event_t* ev)
+static int
+handle_focus_output(const uint32_t* args)
 {
-  if (!workspaces[current_workspace].focused)
-    return;
+  int output = args[0];
+  if (output < 0 || output >= output_count())
+    return IPC_ERR_OUTPUT;
 
-  int workspace = ev->data.data32[0];
-  send_window_to_workspace(workspaces[current_workspace].focused, workspace);
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    if (workspaces[i].output == output && i != current_workspace)
+      set_current_workspace(i);
+  }
+  return IPC_OK;
 }
 
-static void
-handle_quit(void)
+static int
+handle_switch_workspace(const uint32_t* args)
 {
-  xcb_disconnect(conn);
-  exit(0);
+  int workspace = args[0];
+  if (workspace < 0 || workspace >= MAX_WORKSPACES)
+    return IPC_ERR_WORKSPACE;
+
+  switch_to_workspace(workspace);
+  return IPC_OK;
 }
 
-void
-handle_map_request(xcb_map_request_event_t* ev)
+static int
+handle_send_to_workspace(const uint32_t* args)
 {
-  debug("Received map request for window: %d", ev->window);
-
-  // Get window geometry
-  xcb_generic_error_t* error;
-  xcb_get_geometry_cookie_t cookie = xcb_get_geometry(conn, ev->window);
-  xcb_get_geometry_reply_t* geom = xcb_get_geometry_reply(conn, cookie, &error);
-  if (error) {
-    debug("Failed to get window geometry for window: %d (error: %d)",
-          ev->window,
-          error->error_code);
-    free(error);
-    return;
+  if (!workspaces[current_workspace].focused)
+    return IPC_ERR_NO_WINDOW;
+
+  int workspace = args[0];
+  if (workspace < 0 || workspace >= MAX_WORKSPACES)
+    return IPC_ERR_WORKSPACE;
+
+  send_window_to_workspace(workspaces[current_workspace].focused, workspace);
+  return IPC_OK;
+}
+
+static int
+handle_reset_stats(const uint32_t* args)
+{
+  (void)args;
+
+  stats_reset();
+  return IPC_OK;
+}
+
+static int
+handle_quit(const uint32_t* args)
+{
+  (void)args;
+
+  // Leave the event loop once replies have gone out
+  running = false;
+  return IPC_OK;
+}
+
+// Ask for both name properties, the replies are picked up by
+// finish_pending_titles()
+static void
+request_title(xcb_window_t window)
+{
+  if (pending_titles.count == pending_titles.capacity) {
+    pending_titles.capacity =
+      pending_titles.capacity ? pending_titles.capacity * 2 : 8;
+    pending_titles.items =
+      realloc(pending_titles.items,
+              sizeof(struct PendingTitle) * pending_titles.capacity);
+    if (!pending_titles.items)
+      die("Failed to allocate title requests");
+  }
+
+  struct PendingTitle* pt = &pending_titles.items[pending_titles.count++];
+  pt->window = window;
+  pt->net_name = xreq_get_property(
+    conn, 0, window, net_wm_name_atom, utf8_string_atom, 0, 256);
+  pt->name = xreq_get_property(
+    conn, 0, window, XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, 256);
+}
+
+static char*
+title_from_reply(xcb_get_property_reply_t* reply, bool utf8)
+{
+  if (!reply || !xcb_get_property_value_length(reply))
+    return NULL;
+
+  return title_from_property(xcb_get_property_value(reply),
+                             xcb_get_property_value_length(reply),
+                             utf8);
+}
+
+// Update the titles whose replies have arrived, in request order. The
+// EWMH name wins over WM_NAME.
+static void
+finish_pending_titles(void)
+{
+  int done = 0;
+
+  while (done < pending_titles.count) {
+    struct PendingTitle* pt = &pending_titles.items[done];
+    xcb_get_property_reply_t* net_name = NULL;
+    xcb_get_property_reply_t* name = NULL;
+
+    // Replies come in order, so the second one tells for both
+    if (!xreq_poll_for_reply(conn, pt->name.sequence, (void**)&name, NULL))
+      break;
+    xreq_poll_for_reply(conn, pt->net_name.sequence, (void**)&net_name, NULL);
+    done++;
+
+    struct Window* win = window_find(pt->window);
+    char* text = title_from_reply(net_name, true);
+    if (!text)
+      text = title_from_reply(name, false);
+
+    if (win && text && (!win->title.text || strcmp(text, win->title.text))) {
+      free(win->title.text);
+      win->title.text = text;
+      win->title.dirty = true;
+      scene_queue(win);
+    } else {
+      free(text);
+    }
+
+    free(net_name);
+    free(name);
   }
 
+  pending_titles.count -= done;
+  memmove(pending_titles.items,
+          pending_titles.items + done,
+          sizeof(struct PendingTitle) * pending_titles.count);
+}
+
+static void
+manage_window(xcb_window_t id, const xcb_get_geometry_reply_t* geom)
+{
   // Create frame window
-  xcb_window_t frame = xcb_generate_id(conn);
-  uint32_t frame_vals[] = { UNFOCUSED_BORDER_COLOR,
+  xcb_window_t frame = xreq_generate_id(conn);
+  uint32_t frame_vals[] = { settings.unfocused_border_color,
                             XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY |
                               XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT };
 
-  int16_t frame_x = geom->x;
-  int16_t frame_y = (geom->y < HEADER_SIZE) ? 0 : geom->y - HEADER_SIZE;
-
-  xcb_create_window(conn,
-                    screen->root_depth,
-                    frame,
-                    screen->root,
-                    frame_x,
-                    frame_y,
-                    geom->width,
-                    geom->height + HEADER_SIZE,
-                    BORDER_SIZE,
-                    XCB_WINDOW_CLASS_INPUT_OUTPUT,
-                    screen->root_visual,
-                    XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK,
-                    frame_vals);
+  // Frames live in container coordinates, and a window outside the
+  // container would never be seen
+  struct Rect area = workspaces[current_workspace].area;
+  int16_t x = geom->x - area.x;
+  int16_t y = geom->y - area.y;
+  if (x < 0 || x >= area.width)
+    x = 0;
+  if (y < 0 || y >= area.height)
+    y = 0;
+
+  int16_t frame_x = x;
+  int16_t frame_y = (y < settings.header_size) ? 0 : y - settings.header_size;
+
+  xreq_create_window(conn,
+                     screen->root_depth,
+                     frame,
+                     workspaces[current_workspace].container,
+                     frame_x,
+                     frame_y,
+                     geom->width,
+                     geom->height + settings.header_size,
+                     settings.border_size,
+                     XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                     screen->root_visual,
+                     XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK,
+                     frame_vals);
 
   // Create header window
-  xcb_window_t header = xcb_generate_id(conn);
-  uint32_t header_vals[] = { UNFOCUSED_HEADER_COLOR,
+  xcb_window_t header = xreq_generate_id(conn);
+  uint32_t header_vals[] = { settings.unfocused_header_color,
                              XCB_EVENT_MASK_BUTTON_PRESS |
                                XCB_EVENT_MASK_BUTTON_RELEASE |
                                XCB_EVENT_MASK_BUTTON_1_MOTION };
 
-  xcb_create_window(conn,
-                    screen->root_depth,
-                    header,
-                    frame,
-                    0,
-                    0,
-                    geom->width,
-                    HEADER_SIZE,
-                    0,
-                    XCB_WINDOW_CLASS_INPUT_OUTPUT,
-                    screen->root_visual,
-                    XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK,
-                    header_vals);
-
-  struct Window* win = window_create(
-    ev->window, frame, header, geom->x, geom->y, geom->width, geom->height);
-
-  // Reparent client window
-  xcb_reparent_window(conn, ev->window, frame, 0, HEADER_SIZE);
+  xreq_create_window(conn,
+                     screen->root_depth,
+                     header,
+                     frame,
+                     0,
+                     0,
+                     geom->width,
+                     settings.header_size,
+                     0,
+                     XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                     screen->root_visual,
+                     XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK,
+                     header_vals);
+
+  // The window's geometry is the frame's, header included
+  struct Window* win = window_create(id,
+                                     frame,
+                                     header,
+                                     frame_x,
+                                     frame_y,
+                                     geom->width,
+                                     geom->height + settings.header_size);
+  publish(IPC_EVENT_MAP, current_workspace, id, 0);
+
+  // Record what was just created, the frame and header get mapped by
+  // the next commit
+  win->scene.frame.sent =
+    (struct SceneState){ frame_x,
+                         frame_y,
+                         geom->width,
+                         geom->height + settings.header_size,
+                         settings.border_size,
+                         settings.unfocused_border_color,
+                         0,
+                         XCB_NONE,
+                         false };
+  win->scene.header.sent =
+    (struct SceneState){ 0,
+                         0,
+                         geom->width,
+                         settings.header_size,
+                         0,
+                         0,
+                         settings.unfocused_header_color,
+                         XCB_NONE,
+                         false };
+  win->scene.client.sent = (struct SceneState){
+    0, settings.header_size, geom->width, geom->height, 0, 0, 0, 0, true
+  };
+  win->scene.frame.want = win->scene.frame.sent;
+  win->scene.header.want = win->scene.header.sent;
+  win->scene.client.want = win->scene.client.sent;
+  win->scene.frame.want.mapped = true;
+  win->scene.header.want.mapped = true;
+  scene_queue(win);
+
+  // Follow title changes
+  uint32_t client_vals[] = { XCB_EVENT_MASK_PROPERTY_CHANGE };
+  xreq_change_window_attributes(conn, id, XCB_CW_EVENT_MASK, client_vals);
+  request_title(id);
+
+  // Reparent client window, the save-set hands it back to the root
+  // window should we exit
+  xreq_change_save_set(conn, XCB_SET_MODE_INSERT, id);
+  xreq_reparent_window(conn, id, frame, 0, settings.header_size);
 
   // Focus frame window
   focus_window(win);
 
-  xcb_map_window(conn, frame);
-  xcb_map_window(conn, header);
-  xcb_map_window(conn, ev->window);
-
-  free(geom);
-  xcb_flush(conn);
+  xreq_map_window(conn, id);
 }
 
 static void
 handle_configure_request(xcb_configure_request_event_t* ev)
 {
-  debug("Handling configure request for window: %d", ev->window);
+  log_debug("Handling configure request for window: %d", ev->window);
+
+  // Merge into the window's pending request, newer values win
+  struct PendingConfigure* pc = NULL;
+  for (int i = 0; i < pending_configures.count; i++) {
+    if (pending_configures.items[i].window == ev->window) {
+      pc = &pending_configures.items[i];
+      loop_stats.merged++;
+      break;
+    }
+  }
 
-  uint32_t values[7];
-  uint32_t value_mask = 0;
+  if (!pc) {
+    if (pending_configures.count == pending_configures.capacity) {
+      pending_configures.capacity =
+        pending_configures.capacity ? pending_configures.capacity * 2 : 8;
+      pending_configures.items =
+        realloc(pending_configures.items,
+                sizeof(struct PendingConfigure) * pending_configures.capacity);
+      if (!pending_configures.items)
+        die("Failed to allocate configure requests");
+    }
+    pc = &pending_configures.items[pending_configures.count++];
+    memset(pc, 0, sizeof(*pc));
+    pc->window = ev->window;
+  }
+
+  if (ev->value_mask & XCB_CONFIG_WINDOW_X)
+    pc->x = ev->x;
+  if (ev->value_mask & XCB_CONFIG_WINDOW_Y)
+    pc->y = ev->y;
+  if (ev->value_mask & XCB_CONFIG_WINDOW_WIDTH)
+    pc->width = ev->width;
+  if (ev->value_mask & XCB_CONFIG_WINDOW_HEIGHT)
+    pc->height = ev->height;
+  if (ev->value_mask & XCB_CONFIG_WINDOW_BORDER_WIDTH)
+    pc->border_width = ev->border_width;
+  if (ev->value_mask & XCB_CONFIG_WINDOW_SIBLING)
+    pc->sibling = ev->sibling;
+  if (ev->value_mask & XCB_CONFIG_WINDOW_STACK_MODE)
+    pc->stack_mode = ev->stack_mode;
+
+  pc->value_mask |= ev->value_mask;
+}
 
-  if (ev->value_mask & XCB_CONFIG_WINDOW_X) {
-    values[value_mask++] = ev->x;
+static void
+drop_pending_configure(xcb_window_t window)
+{
+  for (int i = 0; i < pending_configures.count; i++) {
+    if (pending_configures.items[i].window == window) {
+      pending_configures.items[i] =
+        pending_configures.items[--pending_configures.count];
+      return;
+    }
   }
-  if (ev->value_mask & XCB_CONFIG_WINDOW_Y) {
-    values[value_mask++] = ev->y;
+}
+
+static void
+send_configure(struct PendingConfigure* pc)
+{
+  uint32_t values[7];
+  int n = 0;
+
+  if (pc->value_mask & XCB_CONFIG_WINDOW_X)
+    values[n++] = pc->x;
+  if (pc->value_mask & XCB_CONFIG_WINDOW_Y)
+    values[n++] = pc->y;
+  if (pc->value_mask & XCB_CONFIG_WINDOW_WIDTH)
+    values[n++] = pc->width;
+  if (pc->value_mask & XCB_CONFIG_WINDOW_HEIGHT)
+    values[n++] = pc->height;
+  if (pc->value_mask & XCB_CONFIG_WINDOW_BORDER_WIDTH)
+    values[n++] = pc->border_width;
+  if (pc->value_mask & XCB_CONFIG_WINDOW_SIBLING)
+    values[n++] = pc->sibling;
+  if (pc->value_mask & XCB_CONFIG_WINDOW_STACK_MODE)
+    values[n++] = pc->stack_mode;
+
+  xreq_configure_window(conn, pc->window, pc->value_mask, values);
+
+  // Managed clients keep this geometry until the wm resizes them, so the
+  // next commit of their scene must not put the old one back
+  struct Window* win = window_find(pc->window);
+  if (win && win->id == pc->window) {
+    struct SceneNode* client = &win->scene.client;
+    if (pc->value_mask & XCB_CONFIG_WINDOW_X)
+      client->want.x = client->sent.x = pc->x;
+    if (pc->value_mask & XCB_CONFIG_WINDOW_Y)
+      client->want.y = client->sent.y = pc->y;
+    if (pc->value_mask & XCB_CONFIG_WINDOW_WIDTH)
+      client->want.width = client->sent.width = pc->width;
+    if (pc->value_mask & XCB_CONFIG_WINDOW_HEIGHT)
+      client->want.height = client->sent.height = pc->height;
+    if (pc->value_mask & XCB_CONFIG_WINDOW_BORDER_WIDTH)
+      client->want.border_width = client->sent.border_width =
+        pc->border_width;
   }
-  if (ev->value_mask & XCB_CONFIG_WINDOW_WIDTH) {
-    values[value_mask++] = ev->width;
+}
+
+// Send the configure pending for window ahead of the batch, if any
+static void
+send_pending_configure(xcb_window_t window)
+{
+  for (int i = 0; i < pending_configures.count; i++) {
+    if (pending_configures.items[i].window == window) {
+      send_configure(&pending_configures.items[i]);
+      pending_configures.items[i] =
+        pending_configures.items[--pending_configures.count];
+      return;
+    }
   }
-  if (ev->value_mask & XCB_CONFIG_WINDOW_HEIGHT) {
-    values[value_mask++] = ev->height;
+}
+
+static void
+commit_pending_configures(void)
+{
+  for (int i = 0; i < pending_configures.count; i++)
+    send_configure(&pending_configures.items[i]);
+  pending_configures.count = 0;
+}
+
+static void
+handle_map_request(xcb_map_request_event_t* ev)
+{
+  log_debug("Received map request for window: %d", ev->window);
+
+  // A managed client mapping itself again only needs the map forwarded
+  if (window_find(ev->window)) {
+    xreq_map_window(conn, ev->window);
+    return;
   }
-  if (ev->value_mask & XCB_CONFIG_WINDOW_BORDER_WIDTH) {
-    values[value_mask++] = ev->border_width;
+
+  for (int i = 0; i < pending_maps.count; i++) {
+    if (pending_maps.items[i].window == ev->window)
+      return;
   }
-  if (ev->value_mask & XCB_CONFIG_WINDOW_SIBLING) {
-    values[value_mask++] = ev->sibling;
+
+  // Ask for the geometry now and frame the window once the reply is in,
+  // so other events keep flowing and map bursts share a round trip
+  if (pending_maps.count == pending_maps.capacity) {
+    pending_maps.capacity =
+      pending_maps.capacity ? pending_maps.capacity * 2 : 8;
+    pending_maps.items = realloc(
+      pending_maps.items, sizeof(struct PendingMap) * pending_maps.capacity);
+    if (!pending_maps.items)
+      die("Failed to allocate map requests");
+  }
+
+  struct PendingMap* pm = &pending_maps.items[pending_maps.count++];
+  pm->window = ev->window;
+
+  // A client that resized itself in this batch must be framed at the new
+  // size, so its configure has to reach the server before the query
+  send_pending_configure(ev->window);
+  pm->geometry = xreq_get_geometry(conn, ev->window);
+}
+
+static void
+cancel_pending_map(xcb_window_t window)
+{
+  for (int i = 0; i < pending_maps.count; i++) {
+    if (pending_maps.items[i].window == window)
+      pending_maps.items[i].window = XCB_NONE;
   }
-  if (ev->value_mask & XCB_CONFIG_WINDOW_STACK_MODE) {
-    values[value_mask++] = ev->stack_mode;
+}
+
+// Frame every pending window whose replies have arrived, in request order.
+// With wait set, block until all of them are framed.
+static void
+finish_pending_maps(bool wait)
+{
+  int done = 0;
+
+  while (done < pending_maps.count) {
+    struct PendingMap* pm = &pending_maps.items[done];
+    xcb_get_geometry_reply_t* geom = NULL;
+    xcb_generic_error_t* error = NULL;
+
+    if (wait)
+      geom = xreq_wait_for_reply(conn, pm->geometry.sequence, &error);
+    else if (!xreq_poll_for_reply(
+               conn, pm->geometry.sequence, (void**)&geom, &error))
+      break;
+    done++;
+
+    if (error) {
+      log_warn("Failed to get window geometry for window: %d (error: %d)",
+               pm->window,
+               error->error_code);
+      free(error);
+      continue;
+    }
+
+    if (geom && pm->window != XCB_NONE)
+      manage_window(pm->window, geom);
+
+    free(geom);
   }
 
-  xcb_configure_window(conn, ev->window, ev->value_mask, values);
-  xcb_flush(conn);
+  if (!done)
+    return;
+  pending_maps.count -= done;
+  memmove(pending_maps.items,
+          pending_maps.items + done,
+          sizeof(struct PendingMap) * pending_maps.count);
 }
 
 static void
 handle_create_notify(xcb_create_notify_event_t* ev)
 {
-  debug("Window %d created at (%d, %d) with dimensions %dx%d",
-        ev->window,
-        ev->x,
-        ev->y,
-        ev->width,
-        ev->height);
+  log_debug("Window %d created at (%d, %d) with dimensions %dx%d",
+            ev->window,
+            ev->x,
+            ev->y,
+            ev->width,
+            ev->height);
 }
 
 static void
 handle_destroy_notify(xcb_destroy_notify_event_t* ev)
 {
-  debug("Window %d destroyed", ev->window);
+  log_debug("Window %d destroyed", ev->window);
+
+  drop_pending_configure(ev->window);
+  cancel_pending_map(ev->window);
 
   struct Window* win = window_find(ev->window);
   if (win) {
-    // Clean up frame and header
-    xcb_destroy_window(conn, win->frame);
-    xcb_destroy_window(conn, win->header);
+    // Clean up frame, header and title
+    xreq_destroy_window(conn, win->frame);
+    xreq_destroy_window(conn, win->header);
+    free_title_pixmaps(win);
+    free(win->title.text);
 
-    window_delete(win->id);
-
-    xcb_flush(conn);
+    window_delete(win);
   }
 }
 
+static void
+handle_property_notify(xcb_property_notify_event_t* ev)
+{
+  if (ev->atom != XCB_ATOM_WM_NAME && ev->atom != net_wm_name_atom)
+    return;
+
+  struct Window* win = window_find(ev->window);
+  if (win && win->id == ev->window)
+    request_title(win->id);
+}
+
 static void
 handle_button_press(xcb_button_press_event_t* ev)
 {
@@ -643,13 +1527,16 @@ handle_button_press(xcb_button_press_event_t* ev)
   }
 
   if (!win) {
-    debug(
+    log_debug(
       "No window found for event window %d or child %d", ev->event, ev->child);
-    xcb_allow_events(conn, XCB_ALLOW_REPLAY_POINTER, ev->time);
-    xcb_flush(conn);
+    xreq_allow_events(conn, XCB_ALLOW_REPLAY_POINTER, ev->time);
     return;
   }
 
+  // Clicking a window on another output moves there
+  if (win->workspace != current_workspace)
+    set_current_workspace(win->workspace);
+
   // Focus clicked window
   focus_window(win);
 
@@ -660,10 +1547,44 @@ handle_button_press(xcb_button_press_event_t* ev)
     drag_state.orig_y = win->y;
     drag_state.press_x = ev->root_x;
     drag_state.press_y = ev->root_y;
+    drag_state.motion_pending = false;
   }
 
-  xcb_allow_events(conn, XCB_ALLOW_REPLAY_POINTER, ev->time);
-  xcb_flush(conn);
+  xreq_allow_events(conn, XCB_ALLOW_REPLAY_POINTER, ev->time);
+}
+
+static void
+apply_drag_motion(void)
+{
+  if (!drag_state.window || !drag_state.motion_pending)
+    return;
+
+  // Calculate the change in position
+  int16_t delta_x = drag_state.motion_x - drag_state.press_x;
+  int16_t delta_y = drag_state.motion_y - drag_state.press_y;
+
+  // Update position of the frame window
+  move_window(drag_state.window,
+              drag_state.orig_x + delta_x,
+              drag_state.orig_y + delta_y);
+
+  drag_state.motion_pending = false;
+  drag_state.motion_time = now_ns();
+}
+
+// Milliseconds until pending drag motion may be applied, -1 if none
+static int
+drag_motion_timeout(void)
+{
+  if (!drag_state.window || !drag_state.motion_pending)
+    return -1;
+
+  uint64_t interval = settings.motion_interval;
+  uint64_t elapsed = now_ns() - drag_state.motion_time;
+  if (elapsed >= interval)
+    return 0;
+
+  return (int)((interval - elapsed + 999999) / 1000000);
 }
 
 static void
@@ -674,6 +1595,8 @@ handle_button_release(xcb_button_release_event_t* ev)
   if (!drag_state.window)
     return;
 
+  // Land on the final pointer position regardless of pacing
+  apply_drag_motion();
   drag_state.window = NULL;
 }
 
@@ -683,104 +1606,939 @@ handle_motion_notify(xcb_motion_notify_event_t* ev)
   if (!drag_state.window)
     return;
 
-  // Calculate the change in position
-  int16_t delta_x = ev->root_x - drag_state.press_x;
-  int16_t delta_y = ev->root_y - drag_state.press_y;
+  // Only keep the newest position, it is applied once per refresh
+  if (drag_state.motion_pending)
+    loop_stats.merged++;
 
-  // Update position of the frame window
-  drag_state.window->x = drag_state.orig_x + delta_x;
-  drag_state.window->y = drag_state.orig_y + delta_y;
-  uint32_t values[2] = { drag_state.window->x, drag_state.window->y };
+  drag_state.motion_x = ev->root_x;
+  drag_state.motion_y = ev->root_y;
+  drag_state.motion_pending = true;
+}
+
+static void
+commit_scene_node(xcb_window_t id, struct SceneNode* node)
+{
+  struct SceneState* want = &node->want;
+  struct SceneState* sent = &node->sent;
+  uint32_t values[5];
+  uint16_t mask = 0;
+  int n = 0;
+
+  // Value order follows the mask bits
+  if (want->x != sent->x) {
+    mask |= XCB_CONFIG_WINDOW_X;
+    values[n++] = want->x;
+  }
+  if (want->y != sent->y) {
+    mask |= XCB_CONFIG_WINDOW_Y;
+    values[n++] = want->y;
+  }
+  if (want->width != sent->width) {
+    mask |= XCB_CONFIG_WINDOW_WIDTH;
+    values[n++] = want->width;
+  }
+  if (want->height != sent->height) {
+    mask |= XCB_CONFIG_WINDOW_HEIGHT;
+    values[n++] = want->height;
+  }
+  if (want->border_width != sent->border_width) {
+    mask |= XCB_CONFIG_WINDOW_BORDER_WIDTH;
+    values[n++] = want->border_width;
+  }
+  if (mask)
+    xreq_configure_window(conn, id, mask, values);
+
+  uint32_t attr_mask = 0;
+  n = 0;
+  if (want->background_pixmap != sent->background_pixmap ||
+      (!want->background_pixmap && want->background != sent->background)) {
+    attr_mask |= want->background_pixmap ? XCB_CW_BACK_PIXMAP
+                                         : XCB_CW_BACK_PIXEL;
+    values[n++] =
+      want->background_pixmap ? want->background_pixmap : want->background;
+  }
+  if (want->border_color != sent->border_color) {
+    attr_mask |= XCB_CW_BORDER_PIXEL;
+    values[n++] = want->border_color;
+  }
+  if (attr_mask)
+    xreq_change_window_attributes(conn, id, attr_mask, values);
+
+  // A new background only shows once the window is cleared
+  if (attr_mask & (XCB_CW_BACK_PIXMAP | XCB_CW_BACK_PIXEL))
+    xreq_clear_area(conn, 0, id, 0, 0, 0, 0);
+
+  if (want->mapped != sent->mapped) {
+    if (want->mapped)
+      xreq_map_window(conn, id);
+    else
+      xreq_unmap_window(conn, id);
+  }
+
+  *sent = *want;
+}
+
+// Draw both header pixmaps again, only when the title text or the header
+// width changed since they were last drawn
+static void
+render_title(struct Window* win)
+{
+  struct SceneState* header = &win->scene.header.want;
+  if (!header->mapped || !win->title.text)
+    return;
+  if (!win->title.dirty && win->title.width == header->width)
+    return;
+
+  free_title_pixmaps(win);
+  win->title.pixmaps[0] = title_render(win->title.text,
+                                       header->width,
+                                       settings.unfocused_header_color,
+                                       settings.unfocused_title_color);
+  win->title.pixmaps[1] = title_render(win->title.text,
+                                       header->width,
+                                       settings.focused_header_color,
+                                       settings.focused_title_color);
+  win->title.width = header->width;
+  win->title.dirty = false;
+
+  header->background_pixmap = win->title.pixmaps[win->title.focused];
+}
+
+// Send the minimal set of requests that brings every changed window on
+// the server in line with its scene
+static void
+commit_scene(void)
+{
+  for (int i = 0; i < dirty_scenes.count; i++) {
+    struct Window* win = dirty_scenes.items[i];
+    if (!win)
+      continue;
+
+    render_title(win);
+    commit_scene_node(win->frame, &win->scene.frame);
+    commit_scene_node(win->header, &win->scene.header);
+    commit_scene_node(win->id, &win->scene.client);
+    win->scene.queued = false;
+  }
+  dirty_scenes.count = 0;
+}
+
+// Arrange the tiled windows of every workspace whose window set changed.
+// Only windows whose rectangle moved are reconfigured.
+static void
+commit_layouts(void)
+{
+  static struct Window** tiled;
+  static struct Rect* rects;
+  static int capacity;
+
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    struct Workspace* ws = &workspaces[i];
+    if (!ws->layout_dirty)
+      continue;
+    ws->layout_dirty = false;
+
+    if (ws->layout == LAYOUT_FLOATING)
+      continue;
+
+    if (ws->window_count > capacity) {
+      capacity = ws->window_count * 2;
+      tiled = realloc(tiled, sizeof(*tiled) * capacity);
+      rects = realloc(rects, sizeof(*rects) * capacity);
+      if (!tiled || !rects)
+        die("Failed to allocate layout");
+    }
+
+    // Snapped, maximized and fullscreen windows keep their geometry
+    int count = 0;
+    for (struct Window* w = ws->windows; w; w = w->next) {
+      if (w->state == STATE_NORMAL)
+        tiled[count++] = w;
+    }
+
+    layout_arrange(ws->layout, count, workspace_area(i), rects);
+
+    // Frame borders are drawn outside the frame geometry. Tiles too small
+    // for the decorations still leave the client a pixel, and overlap.
+    int border = 2 * settings.border_size;
+    int min_width = 1 + border;
+    int min_height = settings.header_size + 1 + border;
+
+    for (int j = 0; j < count; j++) {
+      struct Window* w = tiled[j];
+      int width = rects[j].width < min_width ? min_width : rects[j].width;
+      int height = rects[j].height < min_height ? min_height : rects[j].height;
+      width -= border;
+      height -= border;
+
+      if (w->x != rects[j].x || w->y != rects[j].y || w->width != width ||
+          w->height != height)
+        resize_window(w, rects[j].x, rects[j].y, width, height, true);
+    }
+  }
+}
+
+// Session handed to the next process on restart
+#define SESSION_MAGIC 0x34534d57 // "WMS4"
+
+struct SessionHeader
+{
+  uint32_t magic;
+  uint32_t window_count;
+  int32_t current_workspace;
+  uint32_t containers[MAX_WORKSPACES];
+  uint8_t layouts[MAX_WORKSPACES];
+  int8_t outputs[MAX_WORKSPACES];
+};
+
+struct SessionRecord
+{
+  uint32_t id, frame, header;
+  int16_t x, y;
+  uint16_t width, height;
+  int16_t saved_x, saved_y;
+  uint16_t saved_width, saved_height;
+  uint8_t state;
+  uint8_t workspace;
+  uint8_t focused;
+  uint8_t pad;
+};
+
+static bool
+write_all(int fd, const void* buf, size_t len)
+{
+  const char* p = buf;
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool
+read_all(int fd, void* buf, size_t len)
+{
+  char* p = buf;
+  while (len) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool
+save_session(int fd)
+{
+  struct SessionHeader hdr = {
+    SESSION_MAGIC, 0, current_workspace, { 0 }, { 0 }, { 0 }
+  };
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    hdr.window_count += workspaces[i].window_count;
+    hdr.containers[i] = workspaces[i].container;
+    hdr.layouts[i] = workspaces[i].layout;
+    hdr.outputs[i] = workspaces[i].output;
+  }
+
+  struct SessionRecord* records =
+    calloc(hdr.window_count ? hdr.window_count : 1, sizeof(*records));
+  if (!records)
+    return false;
+
+  int n = 0;
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    for (struct Window* w = workspaces[i].windows; w; w = w->next) {
+      struct SessionRecord* r = &records[n++];
+      r->id = w->id;
+      r->frame = w->frame;
+      r->header = w->header;
+      r->x = w->x;
+      r->y = w->y;
+      r->width = w->width;
+      r->height = w->height;
+      r->saved_x = w->saved.x;
+      r->saved_y = w->saved.y;
+      r->saved_width = w->saved.width;
+      r->saved_height = w->saved.height;
+      r->state = w->state;
+      r->workspace = i;
+      r->focused = w == workspaces[i].focused;
+    }
+  }
+
+  bool ok = write_all(fd, &hdr, sizeof(hdr)) &&
+            write_all(fd, records, sizeof(*records) * n) &&
+            lseek(fd, 0, SEEK_SET) == 0;
 
-  xcb_configure_window(conn,
-                       drag_state.window->frame,
-                       XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y,
-                       values);
-  xcb_flush(conn);
+  free(records);
+  return ok;
+}
+
+// Rebuild the scene of a restored window. Its server side state is not
+// known, so everything the scene owns is sent again on the next commit.
+static void
+restore_scene(struct Window* win, bool focused)
+{
+  resize_window(win,
+                win->x,
+                win->y,
+                win->width,
+                win->height,
+                win->state != STATE_FULLSCREEN);
+  paint_window(win, focused);
+  win->scene.frame.want.mapped = true;
+
+  struct SceneNode* nodes[] = { &win->scene.frame,
+                                &win->scene.header,
+                                &win->scene.client };
+  for (int i = 0; i < 3; i++) {
+    struct SceneState* want = &nodes[i]->want;
+    struct SceneState* sent = &nodes[i]->sent;
+    sent->x = ~want->x;
+    sent->y = ~want->y;
+    sent->width = ~want->width;
+    sent->height = ~want->height;
+  }
+  win->scene.frame.sent.border_width = ~win->scene.frame.want.border_width;
+  win->scene.frame.sent.border_color = ~win->scene.frame.want.border_color;
+  win->scene.frame.sent.mapped = !win->scene.frame.want.mapped;
+  win->scene.header.sent.background = ~win->scene.header.want.background;
+  win->scene.header.sent.mapped = !win->scene.header.want.mapped;
+}
+
+// Take over the frames left behind by the previous process
+static void
+restore_session(int fd)
+{
+  struct SessionHeader hdr;
+  if (!read_all(fd, &hdr, sizeof(hdr)) || hdr.magic != SESSION_MAGIC) {
+    log_warn("Ignoring invalid session state");
+    close(fd);
+    return;
+  }
+
+  struct SessionRecord* records =
+    calloc(hdr.window_count ? hdr.window_count : 1, sizeof(*records));
+  if (!records ||
+      !read_all(fd, records, sizeof(*records) * hdr.window_count)) {
+    log_warn("Failed to read session state");
+    free(records);
+    close(fd);
+    return;
+  }
+  close(fd);
+
+  if (hdr.current_workspace >= 0 && hdr.current_workspace < MAX_WORKSPACES)
+    current_workspace = hdr.current_workspace;
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    workspaces[i].container = hdr.containers[i];
+    workspaces[i].output = hdr.outputs[i];
+    if (hdr.layouts[i] < LAYOUT_COUNT)
+      workspaces[i].layout = hdr.layouts[i];
+  }
+
+  // Check every client is still alive and inside its frame, all at once
+  xcb_query_tree_cookie_t* cookies =
+    malloc(sizeof(xcb_query_tree_cookie_t) * (hdr.window_count + 1));
+  if (!cookies)
+    die("Failed to allocate session queries");
+  for (uint32_t i = 0; i < hdr.window_count; i++)
+    cookies[i] = xreq_query_tree(conn, records[i].id);
+
+  uint32_t frame_vals[] = { XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY |
+                            XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT };
+  uint32_t header_vals[] = { XCB_EVENT_MASK_BUTTON_PRESS |
+                             XCB_EVENT_MASK_BUTTON_RELEASE |
+                             XCB_EVENT_MASK_BUTTON_1_MOTION };
+  uint32_t client_vals[] = { XCB_EVENT_MASK_PROPERTY_CHANGE };
+
+  int restored = 0;
+  for (uint32_t i = 0; i < hdr.window_count; i++) {
+    struct SessionRecord* r = &records[i];
+    xcb_query_tree_reply_t* tree =
+      xreq_query_tree_reply(conn, cookies[i], NULL);
+
+    if (!tree || r->workspace >= MAX_WORKSPACES) {
+      // Client went away during the restart
+      xreq_destroy_window(conn, r->frame);
+      free(tree);
+      continue;
+    }
+
+    if (tree->parent != r->frame) {
+      int16_t y = r->state == STATE_FULLSCREEN ? 0 : settings.header_size;
+      xreq_reparent_window(conn, r->id, r->frame, 0, y);
+      xreq_map_window(conn, r->id);
+    }
+    free(tree);
+
+    // Event selections and the save-set belonged to the old connection
+    xreq_change_window_attributes(
+      conn, r->frame, XCB_CW_EVENT_MASK, frame_vals);
+    xreq_change_window_attributes(
+      conn, r->header, XCB_CW_EVENT_MASK, header_vals);
+    xreq_change_save_set(conn, XCB_SET_MODE_INSERT, r->id);
+    xreq_change_window_attributes(
+      conn, r->id, XCB_CW_EVENT_MASK, client_vals);
+
+    struct Window* win = window_alloc();
+    win->id = r->id;
+    win->frame = r->frame;
+    win->header = r->header;
+    win->x = r->x;
+    win->y = r->y;
+    win->width = r->width;
+    win->height = r->height;
+    win->state = r->state;
+    win->saved.x = r->saved_x;
+    win->saved.y = r->saved_y;
+    win->saved.width = r->saved_width;
+    win->saved.height = r->saved_height;
+
+    workspace_append(r->workspace, win);
+    window_index_add(win);
+    if (r->focused)
+      workspaces[r->workspace].focused = win;
+    restore_scene(win, r->focused);
+    request_title(win->id);
+    restored++;
+  }
+
+  log_info("Restored %d of %u windows", restored, hdr.window_count);
+
+  free(cookies);
+  free(records);
+}
+
+static void
+restart(void)
+{
+  // Windows still waiting on replies would otherwise be lost
+  finish_pending_maps(true);
+  commit_layouts();
+  commit_pending_configures();
+  commit_scene();
+
+  int fd = memfd_create("wm-session", 0);
+  if (fd < 0) {
+    log_error("Failed to create session state: %s", strerror(errno));
+    return;
+  }
+
+  if (!save_session(fd)) {
+    log_error("Failed to write session state");
+    close(fd);
+    return;
+  }
+
+  // Title pixmaps would outlive us too. Headers keep showing them, and
+  // they are drawn again should the exec fail.
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    for (struct Window* w = workspaces[i].windows; w; w = w->next) {
+      free_title_pixmaps(w);
+      w->title.dirty = true;
+      scene_queue(w);
+    }
+  }
+
+  // Keep frames and headers alive once our connection goes away, and
+  // make sure the server has seen everything before we exec
+  xreq_set_close_down_mode(conn, XCB_CLOSE_DOWN_RETAIN_PERMANENT);
+  free(xreq_get_input_focus_reply(conn, xreq_get_input_focus(conn), NULL));
+
+  // A trace ends with the process that recorded it
+  if (trace_mode == TRACE_REPLAY) {
+    close(fd);
+    running = false;
+    return;
+  }
+  trace_close();
+
+  char fd_arg[16];
+  snprintf(fd_arg, sizeof(fd_arg), "%d", fd);
+  char* args_exec[] = { program_path, "--restore", fd_arg, NULL };
+
+  // The writer thread does not survive the exec
+  log_info("Restarting");
+  log_stop();
+  execvp(program_path, args_exec);
+  execv("/proc/self/exe", args_exec);
+
+  // Still running, so keep going as before
+  log_start();
+  log_error("Failed to restart: %s", strerror(errno));
+  xreq_set_close_down_mode(conn, XCB_CLOSE_DOWN_DESTROY_ALL);
+  close(fd);
+}
+
+static int
+handle_restart(const uint32_t* args)
+{
+  (void)args;
+
+  // Restart once replies have gone out
+  restart_requested = true;
+  return IPC_OK;
+}
+
+static const CommandHandler command_handlers[COMMAND_COUNT] = {
+#define COMMAND_HANDLER(id, name, atom, args, handler) handler,
+  WM_COMMANDS(COMMAND_HANDLER)
+#undef COMMAND_HANDLER
+};
+
+static void
+command_lookup_init(void)
+{
+  for (int i = 0; i < COMMAND_COUNT; i++) {
+    unsigned int slot = command_atoms[i] & (COMMAND_LOOKUP_SIZE - 1);
+    while (command_lookup[slot].atom != XCB_NONE)
+      slot = (slot + 1) & (COMMAND_LOOKUP_SIZE - 1);
+
+    command_lookup[slot].atom = command_atoms[i];
+    command_lookup[slot].command = i;
+  }
+}
+
+static int
+command_lookup_find(xcb_atom_t atom)
+{
+  unsigned int slot = atom & (COMMAND_LOOKUP_SIZE - 1);
+  while (command_lookup[slot].atom != XCB_NONE) {
+    if (command_lookup[slot].atom == atom)
+      return command_lookup[slot].command;
+    slot = (slot + 1) & (COMMAND_LOOKUP_SIZE - 1);
+  }
+  return -1;
+}
+
+int
+wm_execute(int command, const uint32_t* args)
+{
+  struct StatsScope scope = stats_command(command);
+  int status = command_handlers[command](args);
+  stats_end(scope);
+  if (status != IPC_OK)
+    log_debug("Command %s failed: %s",
+              commands[command].name,
+              ipc_status_string(status));
+
+  return status;
+}
+
+// Commands from the socket go into a trace, client messages already do as
+// events
+static int
+execute_socket_command(int command, const uint32_t* args)
+{
+  if (trace_mode == TRACE_RECORD) {
+    uint32_t record[1 + IPC_MAX_ARGS] = { command };
+    memcpy(record + 1, args, sizeof(uint32_t) * IPC_MAX_ARGS);
+    trace_value(TRACE_COMMAND, record, sizeof(record));
+  }
+
+  return wm_execute(command, args);
+}
+
+// Run the socket commands a replayed trace holds at this point
+static unsigned long
+replay_commands(void)
+{
+  unsigned long count = 0;
+
+  while (trace_next_is(TRACE_COMMAND)) {
+    uint32_t record[1 + IPC_MAX_ARGS];
+    trace_value(TRACE_COMMAND, record, sizeof(record));
+    if (record[0] >= COMMAND_COUNT)
+      die("Trace holds unknown command %u", record[0]);
+    wm_execute(record[0], record + 1);
+    count++;
+  }
+
+  return count;
 }
 
 void
 handle_client_message(xcb_client_message_event_t* ev)
 {
-  if (ev->type == quit_command_atom) {
-    handle_quit();
-  } else if (ev->type == kill_command_atom) {
-    handle_kill_window();
-  } else if (ev->type == move_command_atom) {
-    handle_move_window(ev);
-  } else if (ev->type == resize_command_atom) {
-    handle_resize_window(ev);
-  } else if (ev->type == focus_next_command_atom) {
-    focus_window_relative(1);
-  } else if (ev->type == focus_prev_command_atom) {
-    focus_window_relative(-1);
-  } else if (ev->type == maximize_command_atom) {
-    handle_toggle_maximize();
-  } else if (ev->type == fullscreen_command_atom) {
-    handle_toggle_fullscreen();
-  } else if (ev->type == snap_left_command_atom) {
-    handle_toggle_snap_left();
-  } else if (ev->type == snap_right_command_atom) {
-    handle_toggle_snap_right();
-  } else if (ev->type == switch_workspace_command_atom) {
-    handle_switch_workspace(ev);
-  } else if (ev->type == send_to_workspace_command_atom) {
-    handle_send_to_workspace(ev);
-  } else {
-    debug("Unhandled client message type: %d", ev->type);
+  int command = command_lookup_find(ev->type);
+  if (command < 0) {
+    log_debug("Unhandled client message type: %d", ev->type);
+    return;
+  }
+
+  wm_execute(command, ev->data.data32);
+}
+
+// Hand the query thread a fresh copy of the model if it changed
+static void
+publish_snapshot(void)
+{
+  if (!snapshot_dirty)
+    return;
+
+  int count = 0;
+  for (int i = 0; i < MAX_WORKSPACES; i++)
+    count += workspaces[i].window_count;
+
+  struct QuerySnapshot* snap = query_snapshot_new(count);
+  if (!snap)
+    return;
+
+  snap->current_workspace = current_workspace;
+
+  struct QueryWindow* qw = snap->windows;
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    for (struct Window* w = workspaces[i].windows; w; w = w->next, qw++) {
+      qw->id = w->id;
+      qw->frame = w->frame;
+      qw->x = w->x;
+      qw->y = w->y;
+      qw->width = w->width;
+      qw->height = w->height;
+      qw->workspace = i;
+      qw->state = w->state;
+      qw->focused = w == workspaces[i].focused;
+    }
   }
+
+  query_publish(snap);
+  snapshot_dirty = false;
 }
 
 static void
-run(void)
+dispatch_event(xcb_generic_event_t* ev)
+{
+  switch (ev->response_type & ~0x80) {
+    case XCB_MAP_REQUEST:
+      handle_map_request((xcb_map_request_event_t*)ev);
+      break;
+    case XCB_CONFIGURE_REQUEST:
+      handle_configure_request((xcb_configure_request_event_t*)ev);
+      break;
+    case XCB_CREATE_NOTIFY:
+      handle_create_notify((xcb_create_notify_event_t*)ev);
+      break;
+    case XCB_DESTROY_NOTIFY:
+      handle_destroy_notify((xcb_destroy_notify_event_t*)ev);
+      break;
+    case XCB_BUTTON_PRESS:
+      handle_button_press((xcb_button_press_event_t*)ev);
+      break;
+    case XCB_BUTTON_RELEASE:
+      handle_button_release((xcb_button_release_event_t*)ev);
+      break;
+    case XCB_MOTION_NOTIFY:
+      handle_motion_notify((xcb_motion_notify_event_t*)ev);
+      break;
+    case XCB_PROPERTY_NOTIFY:
+      handle_property_notify((xcb_property_notify_event_t*)ev);
+      break;
+    case XCB_ENTER_NOTIFY: // Ignore enter events
+    case XCB_LEAVE_NOTIFY: // Ignore leave events
+      break;
+    case XCB_CLIENT_MESSAGE:
+      handle_client_message((xcb_client_message_event_t*)ev);
+      break;
+    default:
+      if (!output_handle_event(ev))
+        log_debug("Unhandled event: %d", ev->response_type & ~0x80);
+      break;
+  }
+}
+
+static void
+flush(void)
+{
+  xreq_flush(conn);
+  loop_stats.flushes++;
+}
+
+// Wait up to timeout milliseconds (-1 blocks) for X events or command
+// socket activity. Socket commands are run here and counted in commands.
+static xcb_generic_event_t*
+wait_for_event(int timeout, unsigned long* commands)
+{
+  // Queued X events must not starve the command socket, so it is
+  // still polled, just without blocking
+  xcb_generic_event_t* ev = xreq_poll_for_event(conn);
+  if (ev)
+    timeout = 0;
+
+  // A replay takes socket commands from the trace and never waits
+  if (trace_mode == TRACE_REPLAY) {
+    *commands += replay_commands();
+    return ev ? ev : xreq_poll_for_event(conn);
+  }
+
+  // Without a config watch fds[1] is negative, which poll skips
+  struct pollfd fds[2 + SERVER_MAX_POLLFDS];
+  fds[0] = (struct pollfd){ .fd = xreq_get_file_descriptor(conn),
+                            .events = POLLIN };
+  fds[1] = (struct pollfd){ .fd = settings_fd, .events = POLLIN };
+  int count = server_pollfds(fds + 2, SERVER_MAX_POLLFDS);
+
+  if (poll(fds, 2 + count, timeout) > 0) {
+    if ((fds[1].revents & POLLIN) && settings_changed(settings_fd))
+      settings_pending = true;
+    *commands += server_dispatch(fds + 2, count);
+  }
+
+  return ev ? ev : xreq_poll_for_event(conn);
+}
+
+// Load the changed config file and apply it to every frame and header in
+// one pass. The scene only sends what the new settings actually change.
+static void
+reload_settings(void)
+{
+  settings_pending = false;
+
+  struct Settings next;
+  if (trace_mode != TRACE_REPLAY && !settings_load(settings_path(), &next)) {
+    log_warn("Keeping the current settings");
+    return;
+  }
+  trace_value(TRACE_SETTINGS, &next, sizeof(next));
+  settings = next;
+  atomic_store(&log_level, settings.log_level);
+
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    workspaces[i].layout_dirty = true;
+
+    for (struct Window* w = workspaces[i].windows; w; w = w->next) {
+      resize_window(
+        w, w->x, w->y, w->width, w->height, w->state != STATE_FULLSCREEN);
+      paint_window(w, w == workspaces[i].focused);
+      w->title.dirty = true;
+    }
+  }
+
+  log_info("Reloaded settings");
+}
+
+void
+wm_dispatch(xcb_generic_event_t* ev)
+{
+  struct StatsScope scope = stats_event(ev->response_type);
+  dispatch_event(ev);
+  stats_end(scope);
+}
+
+void
+wm_commit(void)
+{
+  struct StatsScope scope = stats_phase(STATS_COMMIT);
+  finish_pending_maps(false);
+  finish_pending_titles();
+  if (settings_pending || trace_next_is(TRACE_SETTINGS))
+    reload_settings();
+  if (output_refresh())
+    assign_outputs();
+  commit_layouts();
+  commit_pending_configures();
+  if (drag_motion_timeout() == 0)
+    apply_drag_motion();
+  commit_scene();
+
+  flush();
+  stats_end(scope);
+}
+
+void
+wm_reload(void)
+{
+  settings_pending = true;
+}
+
+void
+wm_restart(void)
+{
+  restart();
+}
+
+void
+wm_run(void)
 {
   xcb_generic_event_t* ev;
 
-  while ((ev = xcb_wait_for_event(conn))) {
-    switch (ev->response_type & ~0x80) {
-      case XCB_MAP_REQUEST:
-        handle_map_request((xcb_map_request_event_t*)ev);
-        break;
-      case XCB_CONFIGURE_REQUEST:
-        handle_configure_request((xcb_configure_request_event_t*)ev);
-        break;
-      case XCB_CREATE_NOTIFY:
-        handle_create_notify((xcb_create_notify_event_t*)ev);
-        break;
-      case XCB_DESTROY_NOTIFY:
-        handle_destroy_notify((xcb_destroy_notify_event_t*)ev);
-        break;
-      case XCB_BUTTON_PRESS:
-        handle_button_press((xcb_button_press_event_t*)ev);
-        break;
-      case XCB_BUTTON_RELEASE:
-        handle_button_release((xcb_button_release_event_t*)ev);
-        break;
-      case XCB_MOTION_NOTIFY:
-        handle_motion_notify((xcb_motion_notify_event_t*)ev);
-        break;
-      case XCB_ENTER_NOTIFY: // Ignore enter events
-      case XCB_LEAVE_NOTIFY: // Ignore leave events
-        break;
-      case XCB_CLIENT_MESSAGE:
-        handle_client_message((xcb_client_message_event_t*)ev);
-        break;
-      default:
-        debug("Unhandled event: %d", ev->response_type & ~0x80);
-        break;
+  // Block for the first event of a burst, then drain whatever else is
+  // already queued so the whole burst goes out with a single flush.
+  // Configure requests and drag motion are coalesced while draining and
+  // committed once the queue is empty.
+  while (running && !xreq_connection_has_error(conn)) {
+    unsigned long events = 0;
+    unsigned long flushes = loop_stats.flushes;
+
+    ev = wait_for_event(drag_motion_timeout(), &events);
+
+    while (ev) {
+      wm_dispatch(ev);
+      free(ev);
+      events++;
+      ev = xreq_poll_for_event(conn);
     }
-    free(ev);
+
+    wm_commit();
+    server_flush();
+    publish_snapshot();
+
+    if (restart_requested) {
+      restart_requested = false;
+      restart();
+    }
+
+    if (!events)
+      continue;
+
+    loop_stats.batches++;
+    loop_stats.events += events;
+    log_debug("Batch %lu: %lu events, %lu flushes",
+              loop_stats.batches,
+              events,
+              loop_stats.flushes - flushes);
   }
 }
 
+// Create the workspace containers a restored session did not bring along
+// and show a workspace on every output
 static void
-setup(void)
+init_containers(void)
 {
-  conn = xcb_connect(NULL, NULL);
-  if (xcb_connection_has_error(conn))
+  uint32_t values[] = { XCB_BACK_PIXMAP_PARENT_RELATIVE, 1 };
+  struct Rect area = output_area(0);
+
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    struct Workspace* ws = &workspaces[i];
+    ws->area = area;
+
+    // Override redirect keeps containers out of window adoption. Restored
+    // containers are placed again as their geometry is not known.
+    if (ws->container == XCB_NONE) {
+      ws->container = xreq_generate_id(conn);
+      xreq_create_window(conn,
+                         screen->root_depth,
+                         ws->container,
+                         screen->root,
+                         area.x,
+                         area.y,
+                         area.width,
+                         area.height,
+                         0,
+                         XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                         screen->root_visual,
+                         XCB_CW_BACK_PIXMAP | XCB_CW_OVERRIDE_REDIRECT,
+                         values);
+      ws->placed = area;
+    }
+
+    // Grab all button presses on frames, the event child is the frame
+    xreq_grab_button(conn,
+                     0,
+                     ws->container,
+                     XCB_EVENT_MASK_BUTTON_PRESS,
+                     XCB_GRAB_MODE_SYNC,
+                     XCB_GRAB_MODE_ASYNC,
+                     XCB_NONE,
+                     XCB_NONE,
+                     XCB_BUTTON_INDEX_ANY,
+                     XCB_MOD_MASK_ANY);
+
+    if (WORKSPACE_PARKING)
+      xreq_map_window(conn, ws->container);
+  }
+
+  assign_outputs();
+}
+
+// Frame the windows that were already mapped before we started, with all
+// attribute and geometry requests in flight at once
+static void
+adopt_windows(xcb_query_tree_cookie_t tree_cookie)
+{
+  xcb_query_tree_reply_t* tree = xreq_query_tree_reply(conn, tree_cookie, NULL);
+  if (!tree)
+    return;
+
+  int count = xcb_query_tree_children_length(tree);
+  xcb_window_t* children = xcb_query_tree_children(tree);
+
+  xcb_get_window_attributes_cookie_t* attr_cookies =
+    malloc(sizeof(xcb_get_window_attributes_cookie_t) * count);
+  xcb_get_geometry_cookie_t* geom_cookies =
+    malloc(sizeof(xcb_get_geometry_cookie_t) * count);
+  if (count && (!attr_cookies || !geom_cookies))
+    die("Failed to allocate startup queries");
+
+  for (int i = 0; i < count; i++) {
+    attr_cookies[i] = xreq_get_window_attributes(conn, children[i]);
+    geom_cookies[i] = xreq_get_geometry(conn, children[i]);
+  }
+
+  // Children come bottom to top, so the topmost window ends up focused
+  int adopted = 0;
+  for (int i = 0; i < count; i++) {
+    xcb_get_window_attributes_reply_t* attr =
+      xreq_get_window_attributes_reply(conn, attr_cookies[i], NULL);
+    xcb_get_geometry_reply_t* geom =
+      xreq_get_geometry_reply(conn, geom_cookies[i], NULL);
+
+    if (attr && geom && !window_find(children[i]) &&
+        !attr->override_redirect &&
+        attr->map_state == XCB_MAP_STATE_VIEWABLE) {
+      manage_window(children[i], geom);
+      adopted++;
+    }
+
+    free(attr);
+    free(geom);
+  }
+
+  log_info("Adopted %d of %d existing windows", adopted, count);
+
+  free(attr_cookies);
+  free(geom_cookies);
+  free(tree);
+}
+
+static xcb_atom_t
+atom_reply(xcb_intern_atom_cookie_t cookie)
+{
+  xcb_intern_atom_reply_t* reply = xreq_intern_atom_reply(conn, cookie, NULL);
+  xcb_atom_t atom = reply ? reply->atom : XCB_NONE;
+  free(reply);
+  return atom;
+}
+
+void
+wm_setup(char* program, int restore_fd)
+{
+  program_path = program;
+
+  // A missing or bad config file leaves the defaults in place. Replays
+  // use the settings the trace was recorded with.
+  if (trace_mode != TRACE_REPLAY) {
+    const char* path = settings_path();
+    settings_load(path, &settings);
+    settings_fd = settings_watch(path);
+  }
+  trace_value(TRACE_SETTINGS, &settings, sizeof(settings));
+  atomic_store(&log_level, settings.log_level);
+
+  conn = xreq_connect();
+  if (xreq_connection_has_error(conn))
     die("Failed to connect to X server");
 
-  screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+  screen = xreq_screen(conn);
   if (!screen)
     die("Failed to get screen");
 
@@ -789,42 +2547,51 @@ setup(void)
                         XCB_EVENT_MASK_BUTTON_PRESS |
                         XCB_EVENT_MASK_BUTTON_RELEASE };
 
-  xcb_change_window_attributes(conn, screen->root, XCB_CW_EVENT_MASK, values);
-
-  // Grab all button presses on root window
-  xcb_grab_button(conn,
-                  0,
-                  screen->root,
-                  XCB_EVENT_MASK_BUTTON_PRESS,
-                  XCB_GRAB_MODE_SYNC,
-                  XCB_GRAB_MODE_ASYNC,
-                  XCB_NONE,
-                  XCB_NONE,
-                  XCB_BUTTON_INDEX_ANY,
-                  XCB_MOD_MASK_ANY);
-
-  kill_command_atom = init_kill_command_atom(conn);
-  move_command_atom = init_move_command_atom(conn);
-  resize_command_atom = init_resize_command_atom(conn);
-  focus_next_command_atom = init_focus_next_command_atom(conn);
-  focus_prev_command_atom = init_focus_prev_command_atom(conn);
-  maximize_command_atom = init_maximize_command_atom(conn);
-  snap_left_command_atom = init_snap_left_command_atom(conn);
-  snap_right_command_atom = init_snap_right_command_atom(conn);
-  maximize_command_atom = init_maximize_command_atom(conn);
-  fullscreen_command_atom = init_fullscreen_command_atom(conn);
-  switch_workspace_command_atom = init_switch_workspace_command_atom(conn);
-  send_to_workspace_command_atom = init_send_to_workspace_command_atom(conn);
-  quit_command_atom = init_quit_command_atom(conn);
-
-  xcb_flush(conn);
+  xreq_change_window_attributes(conn, screen->root, XCB_CW_EVENT_MASK, values);
+
+  // Existing windows are queried while the atoms are interned
+  xcb_query_tree_cookie_t tree_cookie = xreq_query_tree(conn, screen->root);
+  xcb_intern_atom_cookie_t net_wm_name_cookie =
+    xreq_intern_atom(conn, 0, strlen("_NET_WM_NAME"), "_NET_WM_NAME");
+  xcb_intern_atom_cookie_t utf8_string_cookie =
+    xreq_intern_atom(conn, 0, strlen("UTF8_STRING"), "UTF8_STRING");
+
+  init_command_atoms(conn, NULL, command_atoms);
+  command_lookup_init();
+  net_wm_name_atom = atom_reply(net_wm_name_cookie);
+  utf8_string_atom = atom_reply(utf8_string_cookie);
+
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    workspaces[i].layout = DEFAULT_LAYOUT;
+    workspaces[i].output = -1;
+  }
+  output_init(conn, screen);
+  title_init(conn, screen);
+
+  // Restored frames are managed before adoption so it skips them
+  if (restore_fd >= 0)
+    restore_session(restore_fd);
+  init_containers();
+  adopt_windows(tree_cookie);
+
+  commit_layouts();
+  commit_scene();
+  flush();
+  publish_snapshot();
 }
 
-int
-main(void)
+// Scripts can still use client messages if the socket is unavailable
+void
+wm_listen(void)
 {
-  setup();
-  run();
-  xcb_disconnect(conn);
-  return 0;
-}
\ No newline at end of file
+  server_init(execute_socket_command, stats_report);
+  query_init();
+}
+
+void
+wm_shutdown(void)
+{
+  server_shutdown();
+  query_shutdown();
+  xreq_disconnect(conn);
+}
@@ -0,0 +1,50 @@
+#ifndef WM_H
+#define WM_H
+
+#include <stdint.h>
+#include <xcb/xcb.h>
+
+// The window manager minus main(). It talks to X through whichever xreq
+// backend is in use, so the same code runs against the X server, a
+// replayed trace or the fake server.
+
+// Load the settings, take over the root window and manage the windows
+// already there. program is exec'd on restart, restore_fd holds the
+// session of the previous instance or is -1.
+void
+wm_setup(char* program, int restore_fd);
+
+// Serve the command and query sockets
+void
+wm_listen(void);
+
+// Handle events and socket commands until quit or the connection dies
+void
+wm_run(void);
+
+void
+wm_shutdown(void);
+
+// Handle one event like the loop does, the caller still owns it
+void
+wm_dispatch(xcb_generic_event_t* ev);
+
+// Run a command with IPC_MAX_ARGS arguments, returns an IpcStatus
+int
+wm_execute(int command, const uint32_t* args);
+
+// Send everything the events and commands since the last commit
+// changed, as the loop does after every batch
+void
+wm_commit(void);
+
+// Reload the config file on the next commit, as if it had changed
+void
+wm_reload(void);
+
+// Hand the session to a new instance of the program at once, returns
+// only if that fails
+void
+wm_restart(void);
+
+#endif /* WM_H */
@@ -1,105 +1,68 @@
 #include "ipc.h"
 #include "utils.h"
+#include "xreq.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <xcb/xcb.h>
 
-static xcb_connection_t* conn;
-static xcb_screen_t* screen;
-static xcb_atom_t kill_command_atom;
-static xcb_atom_t move_command_atom;
-static xcb_atom_t resize_command_atom;
-static xcb_atom_t focus_next_command_atom;
-static xcb_atom_t focus_prev_command_atom;
-static xcb_atom_t snap_left_command_atom;
-static xcb_atom_t snap_right_command_atom;
-static xcb_atom_t maximize_command_atom;
-static xcb_atom_t fullscreen_command_atom;
-static xcb_atom_t switch_workspace_command_atom;
-static xcb_atom_t send_to_workspace_command_atom;
-static xcb_atom_t quit_command_atom;
-
-struct Command
-{
-  const char* name;
-  xcb_atom_t* atom;
-  int arg_count;
-};
+#define MAX_LINE_WORDS (IPC_MAX_ARGS + 2)
 
-static const struct Command commands[] = {
-  { "kill-window", &kill_command_atom, 0 },
-  { "move-window", &move_command_atom, 2 },
-  { "resize-window", &resize_command_atom, 2 },
-  { "focus-next", &focus_next_command_atom, 0 },
-  { "focus-prev", &focus_prev_command_atom, 0 },
-  { "toggle-snap-left", &snap_left_command_atom, 0 },
-  { "toggle-snap-right", &snap_right_command_atom, 0 },
-  { "toggle-maximize", &maximize_command_atom, 0 },
-  { "toggle-fullscreen", &fullscreen_command_atom, 0 },
-  { "switch-to-workspace", &switch_workspace_command_atom, 1 },
-  { "send-to-workspace", &send_to_workspace_command_atom, 1 },
-  { "quit", &quit_command_atom, 0 },
+struct Request
+{
+  int command;
+  int32_t args[IPC_MAX_ARGS];
 };
 
-static void
-send_client_message(xcb_connection_t* conn,
-                    xcb_window_t root,
-                    xcb_client_message_event_t* event)
-{
-  xcb_void_cookie_t cookie = xcb_send_event_checked(
-    conn,
-    0,
-    root,
-    XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY,
-    (char*)event);
-
-  xcb_generic_error_t* error = xcb_request_check(conn, cookie);
-  if (error) {
-    debug("Failed to send event: %d", error->error_code);
-    free(error);
-  }
+static xcb_connection_t* conn;
+static xcb_screen_t* screen;
+static xcb_atom_t atoms[COMMAND_COUNT];
+static int socket_fd = -1;
+static int pending_replies; // Socket requests sent but not answered yet
+static int failures;
 
-  xcb_flush(conn);
+static bool
+parse_int(const char* str, int32_t* val)
+{
+  char* endptr;
+  long v = strtol(str, &endptr, 10);
+  if (!*str || *endptr != '\0') {
+    fprintf(stderr, "Error: Expected integer argument: %s\n", str);
+    return false;
+  }
+  *val = (int32_t)v;
+  return true;
 }
 
+// Parse one command and its arguments from words, returns the number of
+// words used or -1 on error
 static int
-parse_int(const char* str)
+parse_request(char** words, int count, struct Request* req)
 {
-  char* endptr;
-  long val = strtol(str, &endptr, 10);
-  if (*endptr != '\0') {
-    die("Expected integer argument");
+  req->command = find_command(words[0]);
+  if (req->command < 0) {
+    fprintf(stderr, "Error: Unknown command: %s\n", words[0]);
+    return -1;
   }
-  return (int)val;
-}
 
-static void
-send_command(int argc, char* argv[])
-{
-  for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
-    if (strcmp(argv[1], commands[i].name) == 0) {
-      if (argc != commands[i].arg_count + 2) {
-        die("Expected %d arguments", commands[i].arg_count);
-      }
-
-      xcb_client_message_event_t event = {
-        .response_type = XCB_CLIENT_MESSAGE | 0x80,
-        .format = 32,
-        .window = screen->root,
-        .type = *commands[i].atom,
-      };
-
-      for (int j = 0; j < commands[i].arg_count; j++) {
-        event.data.data32[j] = parse_int(argv[j + 2]);
-      }
-
-      send_client_message(conn, screen->root, &event);
-      return;
-    }
+  int arg_count = commands[req->command].arg_count;
+  if (count < arg_count + 1) {
+    fprintf(stderr,
+            "Error: %s expects %d arguments\n",
+            commands[req->command].name,
+            arg_count);
+    return -1;
   }
-  debug("Unknown command: %s\n", argv[1]);
-  exit(1);
+
+  memset(req->args, 0, sizeof(req->args));
+  for (int i = 0; i < arg_count; i++) {
+    if (!parse_int(words[i + 1], &req->args[i]))
+      return -1;
+  }
+
+  return arg_count + 1;
 }
 
 static void
@@ -112,31 +75,366 @@ setup(void)
   screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
   if (!screen)
     die("Failed to get screen");
+}
+
+// Pick the transport: the wm socket if it is listening, X otherwise.
+// wanted lists the commands known up front so their atoms are interned
+// in a single round trip.
+static void
+connect_wm(const bool* wanted)
+{
+  socket_fd = ipc_connect();
+  if (socket_fd >= 0)
+    return;
+
+  setup();
+  if (wanted)
+    init_command_atoms(conn, wanted, atoms);
+}
+
+static void
+read_replies(void)
+{
+  for (; pending_replies > 0; pending_replies--) {
+    int status;
+    char text[IPC_MAX_MESSAGE];
+
+    if (ipc_read_reply(socket_fd, &status, text, sizeof(text)) < 0)
+      die("Lost connection to window manager");
+
+    if (status != IPC_OK) {
+      fprintf(stderr, "Error: %s\n", text);
+      failures++;
+    } else if (*text) {
+      printf("%s", text);
+    }
+  }
+}
+
+// Queue a command, nothing is guaranteed to be sent before flush_requests()
+static void
+send_request(const struct Request* req)
+{
+  if (socket_fd >= 0) {
+    if (ipc_send_request(socket_fd,
+                         req->command,
+                         req->args,
+                         commands[req->command].arg_count) < 0)
+      die("Lost connection to window manager");
+    pending_replies++;
+    return;
+  }
+
+  if (atoms[req->command] == XCB_NONE)
+    atoms[req->command] = init_command_atom(conn, req->command);
+
+  xcb_client_message_event_t event = {
+    .response_type = XCB_CLIENT_MESSAGE | 0x80,
+    .format = 32,
+    .window = screen->root,
+    .type = atoms[req->command],
+  };
+  memcpy(event.data.data32, req->args, sizeof(req->args));
+
+  // Unchecked, errors are collected by sync_requests()
+  xreq_send_event(conn,
+                  0,
+                  screen->root,
+                  XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
+                    XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY,
+                  (char*)&event);
+}
+
+static void
+flush_requests(void)
+{
+  if (socket_fd >= 0)
+    read_replies();
+  else
+    xreq_flush(conn);
+}
+
+// Wait until the X server has processed everything and report errors
+static void
+sync_requests(void)
+{
+  if (socket_fd >= 0)
+    return;
+
+  free(xreq_get_input_focus_reply(conn, xreq_get_input_focus(conn), NULL));
+
+  xcb_generic_event_t* ev;
+  while ((ev = xcb_poll_for_event(conn))) {
+    if (ev->response_type == 0) {
+      fprintf(stderr,
+              "Error: Failed to send event: %d\n",
+              ((xcb_generic_error_t*)ev)->error_code);
+      failures++;
+    }
+    free(ev);
+  }
+}
+
+static void
+disconnect_wm(void)
+{
+  if (socket_fd >= 0)
+    close(socket_fd);
+  else
+    xcb_disconnect(conn);
+}
+
+// Commands on the command line are parsed up front, then sent in one go
+static void
+run_args(int argc, char* argv[], bool sync)
+{
+  struct Request* reqs = malloc(sizeof(struct Request) * argc);
+  bool wanted[COMMAND_COUNT] = { false };
+  int count = 0;
+
+  if (!reqs)
+    die("Failed to allocate requests");
+
+  for (int i = 0; i < argc;) {
+    int used = parse_request(argv + i, argc - i, &reqs[count]);
+    if (used < 0)
+      exit(1);
+    wanted[reqs[count++].command] = true;
+    i += used;
+  }
+
+  connect_wm(wanted);
+  for (int i = 0; i < count; i++)
+    send_request(&reqs[i]);
+  flush_requests();
+  if (sync)
+    sync_requests();
+  disconnect_wm();
+
+  free(reqs);
+}
+
+static void
+run_line(char* line)
+{
+  char* words[MAX_LINE_WORDS];
+  int count = 0;
+
+  for (char* w = strtok(line, " \t\r"); w && count < MAX_LINE_WORDS;
+       w = strtok(NULL, " \t\r"))
+    words[count++] = w;
+
+  if (!count || words[0][0] == '#')
+    return;
+
+  struct Request req;
+  int used = parse_request(words, count, &req);
+  if (used == count) {
+    send_request(&req);
+    return;
+  }
+
+  if (used >= 0)
+    fprintf(stderr, "Error: Trailing arguments: %s\n", words[used]);
+  failures++;
+}
+
+// One command per line. Requests are flushed whenever no complete line is
+// left in the buffer, so piped bursts are batched and interactive use
+// stays live.
+static void
+run_stdin(bool sync)
+{
+  char buf[4096];
+  size_t len = 0;
 
-  kill_command_atom = init_kill_command_atom(conn);
-  move_command_atom = init_move_command_atom(conn);
-  resize_command_atom = init_resize_command_atom(conn);
-  focus_next_command_atom = init_focus_next_command_atom(conn);
-  focus_prev_command_atom = init_focus_prev_command_atom(conn);
-  snap_left_command_atom = init_snap_left_command_atom(conn);
-  snap_right_command_atom = init_snap_right_command_atom(conn);
-  maximize_command_atom = init_maximize_command_atom(conn);
-  fullscreen_command_atom = init_fullscreen_command_atom(conn);
-  switch_workspace_command_atom = init_switch_workspace_command_atom(conn);
-  send_to_workspace_command_atom = init_send_to_workspace_command_atom(conn);
-  quit_command_atom = init_quit_command_atom(conn);
+  connect_wm(NULL);
 
-  xcb_flush(conn);
+  for (;;) {
+    char* nl = memchr(buf, '\n', len);
+    if (nl) {
+      *nl = '\0';
+      run_line(buf);
+      len -= nl + 1 - buf;
+      memmove(buf, nl + 1, len);
+      continue;
+    }
+
+    if (len == sizeof(buf) - 1) {
+      fprintf(stderr, "Error: Line too long\n");
+      failures++;
+      len = 0;
+    }
+
+    flush_requests();
+
+    ssize_t n = read(STDIN_FILENO, buf + len, sizeof(buf) - 1 - len);
+    if (n <= 0) {
+      // Last line without a newline
+      buf[len] = '\0';
+      run_line(buf);
+      break;
+    }
+    len += n;
+  }
+
+  flush_requests();
+  if (sync)
+    sync_requests();
+  disconnect_wm();
+}
+
+static void
+run_query(int query)
+{
+  int fd = ipc_connect_query();
+  if (fd < 0)
+    die("Window manager is not serving queries");
+
+  int status;
+  char* text = NULL;
+  if (ipc_send_request(fd, query, NULL, 0) < 0 ||
+      !(text = ipc_read_reply_alloc(fd, &status)))
+    die("Lost connection to window manager");
+  close(fd);
+
+  if (status != IPC_OK)
+    die("%s", text);
+
+  fputs(text, stdout);
+  free(text);
+}
+
+// Print the latency histograms the wm recorded so far
+static void
+run_stats(void)
+{
+  int fd = ipc_connect();
+  if (fd < 0)
+    die("Window manager is not listening on its socket");
+
+  int status;
+  char* text = NULL;
+  if (ipc_send_request(fd, IPC_STATS, NULL, 0) < 0 ||
+      !(text = ipc_read_reply_alloc(fd, &status)))
+    die("Lost connection to window manager");
+  close(fd);
+
+  if (status != IPC_OK)
+    die("%s", text);
+
+  fputs(text, stdout);
+  free(text);
+}
+
+// Print wm events one per line until the connection closes
+static void
+run_subscribe(void)
+{
+  int fd = ipc_connect();
+  if (fd < 0)
+    die("Window manager is not listening on its socket");
+
+  int status;
+  char text[IPC_MAX_MESSAGE];
+  if (ipc_send_request(fd, IPC_SUBSCRIBE, NULL, 0) < 0 ||
+      ipc_read_reply(fd, &status, text, sizeof(text)) < 0)
+    die("Lost connection to window manager");
+  if (status != IPC_OK)
+    die("%s", text);
+
+  struct IpcEvent ev;
+  while (ipc_read_event(fd, &ev) == 0) {
+    printf("%s workspace=%u window=0x%x",
+           ipc_event_name(ev.type),
+           ev.workspace,
+           ev.window);
+    if (ev.type == IPC_EVENT_WORKSPACE)
+      printf(" previous=%u", ev.value);
+    else if (ev.type == IPC_EVENT_STATE)
+      printf(" state=%s", ipc_state_name(ev.value));
+    else if (ev.type == IPC_EVENT_DROPPED)
+      printf(" count=%u", ev.value);
+    printf("\n");
+    fflush(stdout);
+  }
+
+  close(fd);
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr,
+          "Usage: wmc [--sync] [--x-stats] COMMAND [ARGS...] "
+          "[COMMAND [ARGS...]]...\n"
+          "       wmc [--sync] [--x-stats] --stdin\n"
+          "       wmc --subscribe\n"
+          "       wmc list-windows | get-state | stats\n\n"
+          "Commands:\n");
+  for (int i = 0; i < COMMAND_COUNT; i++)
+    fprintf(stderr, "  %s (%d)\n", commands[i].name, commands[i].arg_count);
+  exit(1);
 }
 
 int
 main(int argc, char* argv[])
 {
-  if (argc < 2) {
-    return 1;
+  bool sync = false;
+  bool from_stdin = false;
+  bool subscribe = false;
+  bool x_stats = false;
+  int i = 1;
+
+  for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+    if (strcmp(argv[i], "--sync") == 0)
+      sync = true;
+    else if (strcmp(argv[i], "--stdin") == 0)
+      from_stdin = true;
+    else if (strcmp(argv[i], "--subscribe") == 0)
+      subscribe = true;
+    else if (strcmp(argv[i], "--x-stats") == 0)
+      x_stats = true;
+    else
+      usage();
   }
-  setup();
-  send_command(argc, argv);
-  xcb_disconnect(conn);
-  return 0;
+
+  if (subscribe) {
+    if (from_stdin || i < argc)
+      usage();
+    run_subscribe();
+    return 0;
+  }
+
+  if (from_stdin == (i < argc))
+    usage();
+
+  // Queries go to their own socket and take no arguments
+  if (!from_stdin && argc - i == 1 && find_query(argv[i]) >= 0) {
+    run_query(find_query(argv[i]));
+    return 0;
+  }
+  if (!from_stdin && argc - i == 1 && strcmp(argv[i], "stats") == 0) {
+    run_stats();
+    return 0;
+  }
+
+  // Commands fall back to client messages when the socket is missing
+  struct XreqCounters counters = { 0 };
+  xreq_charge(&counters);
+
+  if (from_stdin)
+    run_stdin(sync);
+  else
+    run_args(argc - i, argv + i, sync);
+
+  if (x_stats)
+    fprintf(stderr,
+            "requests=%llu waits=%llu bytes=%llu flushes=%llu\n",
+            (unsigned long long)counters.requests,
+            (unsigned long long)counters.waits,
+            (unsigned long long)counters.bytes,
+            (unsigned long long)counters.flushes);
+
+  return failures ? 1 : 0;
 }
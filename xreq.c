@@ -0,0 +1,561 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "trace.h"
+#include "xreq.h"
+
+// Request sizes follow the core protocol and RandR encodings
+#define PAD(n) (((n) + 3) & ~3u)
+#define VALUES(mask) (4 * __builtin_popcount(mask))
+
+static struct XreqCounters uncharged;
+static struct XreqCounters* charged = &uncharged;
+static const struct XreqBackend* backend = &xreq_xcb;
+
+struct XreqCounters*
+xreq_charge(struct XreqCounters* counters)
+{
+  struct XreqCounters* previous = charged == &uncharged ? NULL : charged;
+  charged = counters ? counters : &uncharged;
+  return previous;
+}
+
+void
+xreq_use(const struct XreqBackend* use)
+{
+  backend = use;
+}
+
+static void
+sent(uint32_t bytes)
+{
+  charged->requests++;
+  charged->bytes += bytes;
+}
+
+static void
+waited(void)
+{
+  charged->waits++;
+}
+
+static bool
+recording(void)
+{
+  return trace_mode == TRACE_RECORD;
+}
+
+xcb_connection_t*
+xreq_connect(void)
+{
+  return backend->connect();
+}
+
+int
+xreq_connection_has_error(xcb_connection_t* conn)
+{
+  return backend->connection_has_error(conn);
+}
+
+void
+xreq_disconnect(xcb_connection_t* conn)
+{
+  backend->disconnect(conn);
+}
+
+int
+xreq_get_file_descriptor(xcb_connection_t* conn)
+{
+  return backend->get_file_descriptor(conn);
+}
+
+xcb_screen_t*
+xreq_screen(xcb_connection_t* conn)
+{
+  xcb_screen_t* screen = backend->screen(conn);
+  if (screen && recording())
+    trace_value(TRACE_SCREEN, screen, sizeof(*screen));
+  return screen;
+}
+
+uint32_t
+xreq_generate_id(xcb_connection_t* conn)
+{
+  uint32_t id = backend->generate_id(conn);
+  if (recording())
+    trace_value(TRACE_ID, &id, sizeof(id));
+  return id;
+}
+
+const xcb_query_extension_reply_t*
+xreq_get_extension_data(xcb_connection_t* conn, xcb_extension_t* ext)
+{
+  const xcb_query_extension_reply_t* reply =
+    backend->get_extension_data(conn, ext);
+
+  // A missing reply is kept as an absent extension
+  if (recording()) {
+    xcb_query_extension_reply_t copy = { 0 };
+    if (reply)
+      copy = *reply;
+    trace_value(TRACE_EXTENSION, &copy, sizeof(copy));
+  }
+  return reply;
+}
+
+xcb_generic_event_t*
+xreq_poll_for_event(xcb_connection_t* conn)
+{
+  xcb_generic_event_t* ev = backend->poll_for_event(conn);
+  if (recording())
+    trace_event(ev);
+  return ev;
+}
+
+void
+xreq_flush(xcb_connection_t* conn)
+{
+  charged->flushes++;
+  backend->flush(conn);
+}
+
+void
+xreq_allow_events(xcb_connection_t* conn, uint8_t mode, xcb_timestamp_t time)
+{
+  sent(8);
+  if (backend->allow_events)
+    backend->allow_events(conn, mode, time);
+}
+
+void
+xreq_change_gc(xcb_connection_t* conn,
+               xcb_gcontext_t gc,
+               uint32_t value_mask,
+               const uint32_t* values)
+{
+  sent(12 + VALUES(value_mask));
+  if (backend->change_gc)
+    backend->change_gc(conn, gc, value_mask, values);
+}
+
+void
+xreq_change_save_set(xcb_connection_t* conn,
+                     uint8_t mode,
+                     xcb_window_t window)
+{
+  sent(8);
+  if (backend->change_save_set)
+    backend->change_save_set(conn, mode, window);
+}
+
+void
+xreq_change_window_attributes(xcb_connection_t* conn,
+                              xcb_window_t window,
+                              uint32_t value_mask,
+                              const uint32_t* values)
+{
+  sent(12 + VALUES(value_mask));
+  if (backend->change_window_attributes)
+    backend->change_window_attributes(conn, window, value_mask, values);
+}
+
+void
+xreq_clear_area(xcb_connection_t* conn,
+                uint8_t exposures,
+                xcb_window_t window,
+                int16_t x,
+                int16_t y,
+                uint16_t width,
+                uint16_t height)
+{
+  sent(16);
+  if (backend->clear_area)
+    backend->clear_area(conn, exposures, window, x, y, width, height);
+}
+
+void
+xreq_configure_window(xcb_connection_t* conn,
+                      xcb_window_t window,
+                      uint16_t value_mask,
+                      const uint32_t* values)
+{
+  sent(12 + VALUES(value_mask));
+  if (backend->configure_window)
+    backend->configure_window(conn, window, value_mask, values);
+}
+
+void
+xreq_create_gc(xcb_connection_t* conn,
+               xcb_gcontext_t gc,
+               xcb_drawable_t drawable,
+               uint32_t value_mask,
+               const uint32_t* values)
+{
+  sent(16 + VALUES(value_mask));
+  if (backend->create_gc)
+    backend->create_gc(conn, gc, drawable, value_mask, values);
+}
+
+void
+xreq_create_pixmap(xcb_connection_t* conn,
+                   uint8_t depth,
+                   xcb_pixmap_t pixmap,
+                   xcb_drawable_t drawable,
+                   uint16_t width,
+                   uint16_t height)
+{
+  sent(16);
+  if (backend->create_pixmap)
+    backend->create_pixmap(conn, depth, pixmap, drawable, width, height);
+}
+
+void
+xreq_create_window(xcb_connection_t* conn,
+                   uint8_t depth,
+                   xcb_window_t window,
+                   xcb_window_t parent,
+                   int16_t x,
+                   int16_t y,
+                   uint16_t width,
+                   uint16_t height,
+                   uint16_t border_width,
+                   uint16_t class,
+                   xcb_visualid_t visual,
+                   uint32_t value_mask,
+                   const uint32_t* values)
+{
+  sent(32 + VALUES(value_mask));
+  if (backend->create_window)
+    backend->create_window(conn,
+                           depth,
+                           window,
+                           parent,
+                           x,
+                           y,
+                           width,
+                           height,
+                           border_width,
+                           class,
+                           visual,
+                           value_mask,
+                           values);
+}
+
+void
+xreq_destroy_window(xcb_connection_t* conn, xcb_window_t window)
+{
+  sent(8);
+  if (backend->destroy_window)
+    backend->destroy_window(conn, window);
+}
+
+void
+xreq_free_pixmap(xcb_connection_t* conn, xcb_pixmap_t pixmap)
+{
+  sent(8);
+  if (backend->free_pixmap)
+    backend->free_pixmap(conn, pixmap);
+}
+
+void
+xreq_grab_button(xcb_connection_t* conn,
+                 uint8_t owner_events,
+                 xcb_window_t window,
+                 uint16_t event_mask,
+                 uint8_t pointer_mode,
+                 uint8_t keyboard_mode,
+                 xcb_window_t confine_to,
+                 xcb_cursor_t cursor,
+                 uint8_t button,
+                 uint16_t modifiers)
+{
+  sent(24);
+  if (backend->grab_button)
+    backend->grab_button(conn,
+                         owner_events,
+                         window,
+                         event_mask,
+                         pointer_mode,
+                         keyboard_mode,
+                         confine_to,
+                         cursor,
+                         button,
+                         modifiers);
+}
+
+void
+xreq_image_text_8(xcb_connection_t* conn,
+                  uint8_t len,
+                  xcb_drawable_t drawable,
+                  xcb_gcontext_t gc,
+                  int16_t x,
+                  int16_t y,
+                  const char* text)
+{
+  sent(16 + PAD(len));
+  if (backend->image_text_8)
+    backend->image_text_8(conn, len, drawable, gc, x, y, text);
+}
+
+void
+xreq_kill_client(xcb_connection_t* conn, uint32_t resource)
+{
+  sent(8);
+  if (backend->kill_client)
+    backend->kill_client(conn, resource);
+}
+
+void
+xreq_map_window(xcb_connection_t* conn, xcb_window_t window)
+{
+  sent(8);
+  if (backend->map_window)
+    backend->map_window(conn, window);
+}
+
+void
+xreq_open_font(xcb_connection_t* conn,
+               xcb_font_t font,
+               uint16_t len,
+               const char* name)
+{
+  sent(12 + PAD(len));
+  if (backend->open_font)
+    backend->open_font(conn, font, len, name);
+}
+
+void
+xreq_poly_fill_rectangle(xcb_connection_t* conn,
+                         xcb_drawable_t drawable,
+                         xcb_gcontext_t gc,
+                         uint32_t count,
+                         const xcb_rectangle_t* rects)
+{
+  sent(12 + 8 * count);
+  if (backend->poly_fill_rectangle)
+    backend->poly_fill_rectangle(conn, drawable, gc, count, rects);
+}
+
+void
+xreq_reparent_window(xcb_connection_t* conn,
+                     xcb_window_t window,
+                     xcb_window_t parent,
+                     int16_t x,
+                     int16_t y)
+{
+  sent(16);
+  if (backend->reparent_window)
+    backend->reparent_window(conn, window, parent, x, y);
+}
+
+void
+xreq_send_event(xcb_connection_t* conn,
+                uint8_t propagate,
+                xcb_window_t destination,
+                uint32_t event_mask,
+                const char* event)
+{
+  sent(44);
+  if (backend->send_event)
+    backend->send_event(conn, propagate, destination, event_mask, event);
+}
+
+void
+xreq_set_close_down_mode(xcb_connection_t* conn, uint8_t mode)
+{
+  sent(4);
+  if (backend->set_close_down_mode)
+    backend->set_close_down_mode(conn, mode);
+}
+
+void
+xreq_unmap_window(xcb_connection_t* conn, xcb_window_t window)
+{
+  sent(8);
+  if (backend->unmap_window)
+    backend->unmap_window(conn, window);
+}
+
+xcb_get_geometry_cookie_t
+xreq_get_geometry(xcb_connection_t* conn, xcb_drawable_t drawable)
+{
+  sent(8);
+  return (xcb_get_geometry_cookie_t){ backend->get_geometry(conn, drawable) };
+}
+
+xcb_get_geometry_reply_t*
+xreq_get_geometry_reply(xcb_connection_t* conn,
+                        xcb_get_geometry_cookie_t cookie,
+                        xcb_generic_error_t** error)
+{
+  return xreq_wait_for_reply(conn, cookie.sequence, error);
+}
+
+xcb_get_input_focus_cookie_t
+xreq_get_input_focus(xcb_connection_t* conn)
+{
+  sent(4);
+  return (xcb_get_input_focus_cookie_t){ backend->get_input_focus(conn) };
+}
+
+xcb_get_input_focus_reply_t*
+xreq_get_input_focus_reply(xcb_connection_t* conn,
+                           xcb_get_input_focus_cookie_t cookie,
+                           xcb_generic_error_t** error)
+{
+  return xreq_wait_for_reply(conn, cookie.sequence, error);
+}
+
+xcb_get_property_cookie_t
+xreq_get_property(xcb_connection_t* conn,
+                  uint8_t delete,
+                  xcb_window_t window,
+                  xcb_atom_t property,
+                  xcb_atom_t type,
+                  uint32_t offset,
+                  uint32_t length)
+{
+  sent(24);
+  return (xcb_get_property_cookie_t){ backend->get_property(
+    conn, delete, window, property, type, offset, length) };
+}
+
+xcb_get_window_attributes_cookie_t
+xreq_get_window_attributes(xcb_connection_t* conn, xcb_window_t window)
+{
+  sent(8);
+  return (xcb_get_window_attributes_cookie_t){
+    backend->get_window_attributes(conn, window)
+  };
+}
+
+xcb_get_window_attributes_reply_t*
+xreq_get_window_attributes_reply(xcb_connection_t* conn,
+                                 xcb_get_window_attributes_cookie_t cookie,
+                                 xcb_generic_error_t** error)
+{
+  return xreq_wait_for_reply(conn, cookie.sequence, error);
+}
+
+xcb_intern_atom_cookie_t
+xreq_intern_atom(xcb_connection_t* conn,
+                 uint8_t only_if_exists,
+                 uint16_t len,
+                 const char* name)
+{
+  sent(8 + PAD(len));
+  return (xcb_intern_atom_cookie_t){ backend->intern_atom(
+    conn, only_if_exists, len, name) };
+}
+
+xcb_intern_atom_reply_t*
+xreq_intern_atom_reply(xcb_connection_t* conn,
+                       xcb_intern_atom_cookie_t cookie,
+                       xcb_generic_error_t** error)
+{
+  return xreq_wait_for_reply(conn, cookie.sequence, error);
+}
+
+xcb_query_font_cookie_t
+xreq_query_font(xcb_connection_t* conn, xcb_fontable_t font)
+{
+  sent(8);
+  return (xcb_query_font_cookie_t){ backend->query_font(conn, font) };
+}
+
+xcb_query_font_reply_t*
+xreq_query_font_reply(xcb_connection_t* conn,
+                      xcb_query_font_cookie_t cookie,
+                      xcb_generic_error_t** error)
+{
+  return xreq_wait_for_reply(conn, cookie.sequence, error);
+}
+
+xcb_query_tree_cookie_t
+xreq_query_tree(xcb_connection_t* conn, xcb_window_t window)
+{
+  sent(8);
+  return (xcb_query_tree_cookie_t){ backend->query_tree(conn, window) };
+}
+
+xcb_query_tree_reply_t*
+xreq_query_tree_reply(xcb_connection_t* conn,
+                      xcb_query_tree_cookie_t cookie,
+                      xcb_generic_error_t** error)
+{
+  return xreq_wait_for_reply(conn, cookie.sequence, error);
+}
+
+void*
+xreq_wait_for_reply(xcb_connection_t* conn,
+                    unsigned int sequence,
+                    xcb_generic_error_t** error)
+{
+  waited();
+  void* reply = backend->wait_for_reply(conn, sequence, error);
+  if (recording())
+    trace_reply(1, reply, error ? *error : NULL);
+  return reply;
+}
+
+int
+xreq_poll_for_reply(xcb_connection_t* conn,
+                    unsigned int sequence,
+                    void** reply,
+                    xcb_generic_error_t** error)
+{
+  int result = backend->poll_for_reply(conn, sequence, reply, error);
+  if (recording())
+    trace_reply(result,
+                result ? *reply : NULL,
+                result && error ? *error : NULL);
+  return result;
+}
+
+#ifdef HAVE_RANDR
+void
+xreq_randr_select_input(xcb_connection_t* conn,
+                        xcb_window_t window,
+                        uint16_t enable)
+{
+  sent(12);
+  if (backend->randr_select_input)
+    backend->randr_select_input(conn, window, enable);
+}
+
+xcb_randr_get_monitors_cookie_t
+xreq_randr_get_monitors(xcb_connection_t* conn,
+                        xcb_window_t window,
+                        uint8_t get_active)
+{
+  sent(12);
+  return (xcb_randr_get_monitors_cookie_t){ backend->randr_get_monitors(
+    conn, window, get_active) };
+}
+
+xcb_randr_get_monitors_reply_t*
+xreq_randr_get_monitors_reply(xcb_connection_t* conn,
+                              xcb_randr_get_monitors_cookie_t cookie,
+                              xcb_generic_error_t** error)
+{
+  return xreq_wait_for_reply(conn, cookie.sequence, error);
+}
+
+xcb_randr_query_version_cookie_t
+xreq_randr_query_version(xcb_connection_t* conn,
+                         uint32_t major_version,
+                         uint32_t minor_version)
+{
+  sent(12);
+  return (xcb_randr_query_version_cookie_t){ backend->randr_query_version(
+    conn, major_version, minor_version) };
+}
+
+xcb_randr_query_version_reply_t*
+xreq_randr_query_version_reply(xcb_connection_t* conn,
+                               xcb_randr_query_version_cookie_t cookie,
+                               xcb_generic_error_t** error)
+{
+  return xreq_wait_for_reply(conn, cookie.sequence, error);
+}
+#endif
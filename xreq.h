@@ -0,0 +1,457 @@
+#ifndef XREQ_H
+#define XREQ_H
+
+#include <stdint.h>
+#include <xcb/xcb.h>
+#ifdef HAVE_RANDR
+#include <xcb/randr.h>
+#endif
+
+// The X requests the wm and wmc send, each counted against whatever is
+// charged at the time. Apart from counting they behave like the xcb
+// calls of the same name, requests without a reply return nothing.
+// While a trace is recorded everything the server hands back goes into
+// it. Where the requests go is up to the backend in use: the X server,
+// a trace being replayed or the fake server in xreq_fake.h.
+
+// X traffic caused by one piece of work
+struct XreqCounters
+{
+  uint64_t requests; // Requests queued
+  uint64_t waits;    // Replies waited for while blocking
+  uint64_t bytes;    // Request bytes, written by the next flush
+  uint64_t flushes;
+};
+
+// Charge traffic to counters from now on and return the ones charged
+// until now, NULL charges nothing
+struct XreqCounters*
+xreq_charge(struct XreqCounters* counters);
+
+// A backend implements the calls below. Requests without a reply it
+// leaves NULL are dropped, requests with a reply return the sequence
+// number their reply is fetched by.
+struct XreqBackend
+{
+  xcb_connection_t* (*connect)(void);
+  int (*connection_has_error)(xcb_connection_t* conn);
+  void (*disconnect)(xcb_connection_t* conn);
+  int (*get_file_descriptor)(xcb_connection_t* conn);
+  xcb_screen_t* (*screen)(xcb_connection_t* conn);
+  uint32_t (*generate_id)(xcb_connection_t* conn);
+  const xcb_query_extension_reply_t* (*get_extension_data)(
+    xcb_connection_t* conn,
+    xcb_extension_t* ext);
+  xcb_generic_event_t* (*poll_for_event)(xcb_connection_t* conn);
+  void (*flush)(xcb_connection_t* conn);
+  void* (*wait_for_reply)(xcb_connection_t* conn,
+                          unsigned int sequence,
+                          xcb_generic_error_t** error);
+  int (*poll_for_reply)(xcb_connection_t* conn,
+                        unsigned int sequence,
+                        void** reply,
+                        xcb_generic_error_t** error);
+
+  void (*allow_events)(xcb_connection_t* conn,
+                       uint8_t mode,
+                       xcb_timestamp_t time);
+  void (*change_gc)(xcb_connection_t* conn,
+                    xcb_gcontext_t gc,
+                    uint32_t value_mask,
+                    const uint32_t* values);
+  void (*change_save_set)(xcb_connection_t* conn,
+                          uint8_t mode,
+                          xcb_window_t window);
+  void (*change_window_attributes)(xcb_connection_t* conn,
+                                   xcb_window_t window,
+                                   uint32_t value_mask,
+                                   const uint32_t* values);
+  void (*clear_area)(xcb_connection_t* conn,
+                     uint8_t exposures,
+                     xcb_window_t window,
+                     int16_t x,
+                     int16_t y,
+                     uint16_t width,
+                     uint16_t height);
+  void (*configure_window)(xcb_connection_t* conn,
+                           xcb_window_t window,
+                           uint16_t value_mask,
+                           const uint32_t* values);
+  void (*create_gc)(xcb_connection_t* conn,
+                    xcb_gcontext_t gc,
+                    xcb_drawable_t drawable,
+                    uint32_t value_mask,
+                    const uint32_t* values);
+  void (*create_pixmap)(xcb_connection_t* conn,
+                        uint8_t depth,
+                        xcb_pixmap_t pixmap,
+                        xcb_drawable_t drawable,
+                        uint16_t width,
+                        uint16_t height);
+  void (*create_window)(xcb_connection_t* conn,
+                        uint8_t depth,
+                        xcb_window_t window,
+                        xcb_window_t parent,
+                        int16_t x,
+                        int16_t y,
+                        uint16_t width,
+                        uint16_t height,
+                        uint16_t border_width,
+                        uint16_t class,
+                        xcb_visualid_t visual,
+                        uint32_t value_mask,
+                        const uint32_t* values);
+  void (*destroy_window)(xcb_connection_t* conn, xcb_window_t window);
+  void (*free_pixmap)(xcb_connection_t* conn, xcb_pixmap_t pixmap);
+  void (*grab_button)(xcb_connection_t* conn,
+                      uint8_t owner_events,
+                      xcb_window_t window,
+                      uint16_t event_mask,
+                      uint8_t pointer_mode,
+                      uint8_t keyboard_mode,
+                      xcb_window_t confine_to,
+                      xcb_cursor_t cursor,
+                      uint8_t button,
+                      uint16_t modifiers);
+  void (*image_text_8)(xcb_connection_t* conn,
+                       uint8_t len,
+                       xcb_drawable_t drawable,
+                       xcb_gcontext_t gc,
+                       int16_t x,
+                       int16_t y,
+                       const char* text);
+  void (*kill_client)(xcb_connection_t* conn, uint32_t resource);
+  void (*map_window)(xcb_connection_t* conn, xcb_window_t window);
+  void (*open_font)(xcb_connection_t* conn,
+                    xcb_font_t font,
+                    uint16_t len,
+                    const char* name);
+  void (*poly_fill_rectangle)(xcb_connection_t* conn,
+                              xcb_drawable_t drawable,
+                              xcb_gcontext_t gc,
+                              uint32_t count,
+                              const xcb_rectangle_t* rects);
+  void (*reparent_window)(xcb_connection_t* conn,
+                          xcb_window_t window,
+                          xcb_window_t parent,
+                          int16_t x,
+                          int16_t y);
+  void (*send_event)(xcb_connection_t* conn,
+                     uint8_t propagate,
+                     xcb_window_t destination,
+                     uint32_t event_mask,
+                     const char* event);
+  void (*set_close_down_mode)(xcb_connection_t* conn, uint8_t mode);
+  void (*unmap_window)(xcb_connection_t* conn, xcb_window_t window);
+
+  unsigned int (*get_geometry)(xcb_connection_t* conn,
+                               xcb_drawable_t drawable);
+  unsigned int (*get_input_focus)(xcb_connection_t* conn);
+  unsigned int (*get_property)(xcb_connection_t* conn,
+                               uint8_t delete,
+                               xcb_window_t window,
+                               xcb_atom_t property,
+                               xcb_atom_t type,
+                               uint32_t offset,
+                               uint32_t length);
+  unsigned int (*get_window_attributes)(xcb_connection_t* conn,
+                                        xcb_window_t window);
+  unsigned int (*intern_atom)(xcb_connection_t* conn,
+                              uint8_t only_if_exists,
+                              uint16_t len,
+                              const char* name);
+  unsigned int (*query_font)(xcb_connection_t* conn, xcb_fontable_t font);
+  unsigned int (*query_tree)(xcb_connection_t* conn, xcb_window_t window);
+
+#ifdef HAVE_RANDR
+  void (*randr_select_input)(xcb_connection_t* conn,
+                             xcb_window_t window,
+                             uint16_t enable);
+  unsigned int (*randr_get_monitors)(xcb_connection_t* conn,
+                                     xcb_window_t window,
+                                     uint8_t get_active);
+  unsigned int (*randr_query_version)(xcb_connection_t* conn,
+                                      uint32_t major_version,
+                                      uint32_t minor_version);
+#endif
+};
+
+// The X server, used unless told otherwise
+extern const struct XreqBackend xreq_xcb;
+
+// Answers from the trace being replayed, requests are dropped
+extern const struct XreqBackend xreq_replay;
+
+// Send everything through backend from the next connect on
+void
+xreq_use(const struct XreqBackend* backend);
+
+// Connection, NULL for backends without one
+xcb_connection_t*
+xreq_connect(void);
+
+// Replays report an error once the trace is used up
+int
+xreq_connection_has_error(xcb_connection_t* conn);
+
+void
+xreq_disconnect(xcb_connection_t* conn);
+
+// -1 for backends without a connection
+int
+xreq_get_file_descriptor(xcb_connection_t* conn);
+
+// First screen of the display
+xcb_screen_t*
+xreq_screen(xcb_connection_t* conn);
+
+uint32_t
+xreq_generate_id(xcb_connection_t* conn);
+
+const xcb_query_extension_reply_t*
+xreq_get_extension_data(xcb_connection_t* conn, xcb_extension_t* ext);
+
+xcb_generic_event_t*
+xreq_poll_for_event(xcb_connection_t* conn);
+
+void
+xreq_flush(xcb_connection_t* conn);
+
+// Requests without a reply
+
+void
+xreq_allow_events(xcb_connection_t* conn,
+                  uint8_t mode,
+                  xcb_timestamp_t time);
+
+void
+xreq_change_gc(xcb_connection_t* conn,
+               xcb_gcontext_t gc,
+               uint32_t value_mask,
+               const uint32_t* values);
+
+void
+xreq_change_save_set(xcb_connection_t* conn,
+                     uint8_t mode,
+                     xcb_window_t window);
+
+void
+xreq_change_window_attributes(xcb_connection_t* conn,
+                              xcb_window_t window,
+                              uint32_t value_mask,
+                              const uint32_t* values);
+
+void
+xreq_clear_area(xcb_connection_t* conn,
+                uint8_t exposures,
+                xcb_window_t window,
+                int16_t x,
+                int16_t y,
+                uint16_t width,
+                uint16_t height);
+
+void
+xreq_configure_window(xcb_connection_t* conn,
+                      xcb_window_t window,
+                      uint16_t value_mask,
+                      const uint32_t* values);
+
+void
+xreq_create_gc(xcb_connection_t* conn,
+               xcb_gcontext_t gc,
+               xcb_drawable_t drawable,
+               uint32_t value_mask,
+               const uint32_t* values);
+
+void
+xreq_create_pixmap(xcb_connection_t* conn,
+                   uint8_t depth,
+                   xcb_pixmap_t pixmap,
+                   xcb_drawable_t drawable,
+                   uint16_t width,
+                   uint16_t height);
+
+void
+xreq_create_window(xcb_connection_t* conn,
+                   uint8_t depth,
+                   xcb_window_t window,
+                   xcb_window_t parent,
+                   int16_t x,
+                   int16_t y,
+                   uint16_t width,
+                   uint16_t height,
+                   uint16_t border_width,
+                   uint16_t class,
+                   xcb_visualid_t visual,
+                   uint32_t value_mask,
+                   const uint32_t* values);
+
+void
+xreq_destroy_window(xcb_connection_t* conn, xcb_window_t window);
+
+void
+xreq_free_pixmap(xcb_connection_t* conn, xcb_pixmap_t pixmap);
+
+void
+xreq_grab_button(xcb_connection_t* conn,
+                 uint8_t owner_events,
+                 xcb_window_t window,
+                 uint16_t event_mask,
+                 uint8_t pointer_mode,
+                 uint8_t keyboard_mode,
+                 xcb_window_t confine_to,
+                 xcb_cursor_t cursor,
+                 uint8_t button,
+                 uint16_t modifiers);
+
+void
+xreq_image_text_8(xcb_connection_t* conn,
+                  uint8_t len,
+                  xcb_drawable_t drawable,
+                  xcb_gcontext_t gc,
+                  int16_t x,
+                  int16_t y,
+                  const char* text);
+
+void
+xreq_kill_client(xcb_connection_t* conn, uint32_t resource);
+
+void
+xreq_map_window(xcb_connection_t* conn, xcb_window_t window);
+
+void
+xreq_open_font(xcb_connection_t* conn,
+               xcb_font_t font,
+               uint16_t len,
+               const char* name);
+
+void
+xreq_poly_fill_rectangle(xcb_connection_t* conn,
+                         xcb_drawable_t drawable,
+                         xcb_gcontext_t gc,
+                         uint32_t count,
+                         const xcb_rectangle_t* rects);
+
+void
+xreq_reparent_window(xcb_connection_t* conn,
+                     xcb_window_t window,
+                     xcb_window_t parent,
+                     int16_t x,
+                     int16_t y);
+
+void
+xreq_send_event(xcb_connection_t* conn,
+                uint8_t propagate,
+                xcb_window_t destination,
+                uint32_t event_mask,
+                const char* event);
+
+void
+xreq_set_close_down_mode(xcb_connection_t* conn, uint8_t mode);
+
+void
+xreq_unmap_window(xcb_connection_t* conn, xcb_window_t window);
+
+// Requests with a reply. Fetching it blocks and counts as a wait,
+// polling for it does not.
+
+xcb_get_geometry_cookie_t
+xreq_get_geometry(xcb_connection_t* conn, xcb_drawable_t drawable);
+
+xcb_get_geometry_reply_t*
+xreq_get_geometry_reply(xcb_connection_t* conn,
+                        xcb_get_geometry_cookie_t cookie,
+                        xcb_generic_error_t** error);
+
+xcb_get_input_focus_cookie_t
+xreq_get_input_focus(xcb_connection_t* conn);
+
+xcb_get_input_focus_reply_t*
+xreq_get_input_focus_reply(xcb_connection_t* conn,
+                           xcb_get_input_focus_cookie_t cookie,
+                           xcb_generic_error_t** error);
+
+xcb_get_property_cookie_t
+xreq_get_property(xcb_connection_t* conn,
+                  uint8_t delete,
+                  xcb_window_t window,
+                  xcb_atom_t property,
+                  xcb_atom_t type,
+                  uint32_t offset,
+                  uint32_t length);
+
+xcb_get_window_attributes_cookie_t
+xreq_get_window_attributes(xcb_connection_t* conn, xcb_window_t window);
+
+xcb_get_window_attributes_reply_t*
+xreq_get_window_attributes_reply(xcb_connection_t* conn,
+                                 xcb_get_window_attributes_cookie_t cookie,
+                                 xcb_generic_error_t** error);
+
+xcb_intern_atom_cookie_t
+xreq_intern_atom(xcb_connection_t* conn,
+                 uint8_t only_if_exists,
+                 uint16_t len,
+                 const char* name);
+
+xcb_intern_atom_reply_t*
+xreq_intern_atom_reply(xcb_connection_t* conn,
+                       xcb_intern_atom_cookie_t cookie,
+                       xcb_generic_error_t** error);
+
+xcb_query_font_cookie_t
+xreq_query_font(xcb_connection_t* conn, xcb_fontable_t font);
+
+xcb_query_font_reply_t*
+xreq_query_font_reply(xcb_connection_t* conn,
+                      xcb_query_font_cookie_t cookie,
+                      xcb_generic_error_t** error);
+
+xcb_query_tree_cookie_t
+xreq_query_tree(xcb_connection_t* conn, xcb_window_t window);
+
+xcb_query_tree_reply_t*
+xreq_query_tree_reply(xcb_connection_t* conn,
+                      xcb_query_tree_cookie_t cookie,
+                      xcb_generic_error_t** error);
+
+// Reply to any request by sequence number
+void*
+xreq_wait_for_reply(xcb_connection_t* conn,
+                    unsigned int sequence,
+                    xcb_generic_error_t** error);
+
+int
+xreq_poll_for_reply(xcb_connection_t* conn,
+                    unsigned int sequence,
+                    void** reply,
+                    xcb_generic_error_t** error);
+
+#ifdef HAVE_RANDR
+void
+xreq_randr_select_input(xcb_connection_t* conn,
+                        xcb_window_t window,
+                        uint16_t enable);
+
+xcb_randr_get_monitors_cookie_t
+xreq_randr_get_monitors(xcb_connection_t* conn,
+                        xcb_window_t window,
+                        uint8_t get_active);
+
+xcb_randr_get_monitors_reply_t*
+xreq_randr_get_monitors_reply(xcb_connection_t* conn,
+                              xcb_randr_get_monitors_cookie_t cookie,
+                              xcb_generic_error_t** error);
+
+xcb_randr_query_version_cookie_t
+xreq_randr_query_version(xcb_connection_t* conn,
+                         uint32_t major_version,
+                         uint32_t minor_version);
+
+xcb_randr_query_version_reply_t*
+xreq_randr_query_version_reply(xcb_connection_t* conn,
+                               xcb_randr_query_version_cookie_t cookie,
+                               xcb_generic_error_t** error);
+#endif
+
+#endif /* XREQ_H */
@@ -0,0 +1,1154 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "xreq_fake.h"
+
+#define FIRST_ID 0x00400000     // Ids handed to the wm
+#define FIRST_CLIENT 0x02000000 // Ids of fake clients
+#define FIRST_ATOM 0x200        // Past the predefined atoms
+#define HANDOVER_MAGIC 0x4b414657 // "WFAK"
+
+// What the model is handed over as, each window followed by its name
+struct FakeSavedWindow
+{
+  xcb_window_t id;
+  xcb_window_t parent;
+  int16_t x, y;
+  uint16_t width, height;
+  uint16_t border_width;
+  uint8_t mapped;
+  uint8_t override_redirect;
+  uint32_t border_pixel;
+  uint32_t event_mask;
+  uint32_t name_len; // 0 when unset
+};
+
+// Reply or error waiting to be fetched
+struct FakeReply
+{
+  unsigned int sequence; // 0 once fetched
+  void* reply;
+  xcb_generic_error_t* error;
+};
+
+// Chained hash of every window, root included
+struct
+{
+  struct FakeWindow** buckets;
+  unsigned int bits; // log2 of the bucket count
+  unsigned int count;
+} fake_windows = { 0 };
+
+struct
+{
+  struct FakeReply* items; // Fetched ones before head
+  int head;
+  int count;
+  int capacity;
+} fake_replies = { 0 };
+
+struct
+{
+  xcb_generic_event_t** items;
+  int head;
+  int count;
+  int capacity;
+} fake_events = { 0 };
+
+struct
+{
+  char** names; // Atom FIRST_ATOM + i is names[i]
+  int count;
+  int capacity;
+} fake_atoms = { 0 };
+
+static uint64_t counts[256];
+static struct FakeRequest request_log[FAKE_LOG_SIZE];
+static uint64_t logged;
+static unsigned int sequence;
+static uint32_t next_id = FIRST_ID;
+static uint32_t next_client = FIRST_CLIENT;
+static char drawn_text[256]; // Latest ImageText8 string
+
+static xcb_screen_t fake_screen = {
+  .root = FAKE_ROOT,
+  .default_colormap = 0x20,
+  .white_pixel = 0xffffff,
+  .black_pixel = 0,
+  .width_in_pixels = 1920,
+  .height_in_pixels = 1080,
+  .width_in_millimeters = 508,
+  .height_in_millimeters = 286,
+  .min_installed_maps = 1,
+  .max_installed_maps = 1,
+  .root_visual = 0x21,
+  .root_depth = 24,
+  .allowed_depths_len = 0,
+};
+
+static void
+grow(void** items, int* capacity, size_t size)
+{
+  *capacity = *capacity ? *capacity * 2 : 64;
+  *items = realloc(*items, size * *capacity);
+  if (!*items)
+    die("Failed to allocate fake server state");
+}
+
+static void
+note(uint8_t opcode, uint32_t target)
+{
+  counts[opcode]++;
+  request_log[logged++ % FAKE_LOG_SIZE] =
+    (struct FakeRequest){ opcode, target };
+}
+
+static unsigned int
+bucket(xcb_window_t id)
+{
+  return (id * 2654435761u) >> (32 - fake_windows.bits);
+}
+
+static struct FakeWindow*
+find(xcb_window_t id)
+{
+  if (!fake_windows.bits)
+    return NULL;
+
+  struct FakeWindow* win = fake_windows.buckets[bucket(id)];
+  while (win && win->id != id)
+    win = win->next_in_hash;
+  return win;
+}
+
+static void
+hash_insert(struct FakeWindow* win)
+{
+  if (!fake_windows.bits || fake_windows.count >= (1u << fake_windows.bits)) {
+    struct FakeWindow** old = fake_windows.buckets;
+    unsigned int old_size = old ? 1u << fake_windows.bits : 0;
+
+    fake_windows.bits = fake_windows.bits ? fake_windows.bits + 1 : 8;
+    fake_windows.buckets =
+      calloc(1u << fake_windows.bits, sizeof(struct FakeWindow*));
+    if (!fake_windows.buckets)
+      die("Failed to allocate fake windows");
+
+    for (unsigned int i = 0; i < old_size; i++) {
+      for (struct FakeWindow* w = old[i]; w;) {
+        struct FakeWindow* next = w->next_in_hash;
+        unsigned int b = bucket(w->id);
+        w->next_in_hash = fake_windows.buckets[b];
+        fake_windows.buckets[b] = w;
+        w = next;
+      }
+    }
+    free(old);
+  }
+
+  unsigned int b = bucket(win->id);
+  win->next_in_hash = fake_windows.buckets[b];
+  fake_windows.buckets[b] = win;
+  fake_windows.count++;
+}
+
+static void
+hash_remove(struct FakeWindow* win)
+{
+  struct FakeWindow** link = &fake_windows.buckets[bucket(win->id)];
+  while (*link != win)
+    link = &(*link)->next_in_hash;
+  *link = win->next_in_hash;
+  fake_windows.count--;
+}
+
+// Stack win on top of the children of parent
+static void
+link_child(struct FakeWindow* win, struct FakeWindow* parent)
+{
+  win->parent = parent ? parent->id : XCB_NONE;
+  win->above = NULL;
+  win->below = parent ? parent->first_child : NULL;
+  if (win->below)
+    win->below->above = win;
+  if (parent)
+    parent->first_child = win;
+}
+
+static void
+unlink_child(struct FakeWindow* win)
+{
+  struct FakeWindow* parent = find(win->parent);
+  if (win->above)
+    win->above->below = win->below;
+  else if (parent)
+    parent->first_child = win->below;
+  if (win->below)
+    win->below->above = win->above;
+  win->above = win->below = NULL;
+}
+
+static void
+restack(struct FakeWindow* win, uint32_t mode)
+{
+  struct FakeWindow* parent = find(win->parent);
+  if (!parent || (mode != XCB_STACK_MODE_ABOVE && mode != XCB_STACK_MODE_BELOW))
+    return;
+
+  unlink_child(win);
+  if (mode == XCB_STACK_MODE_ABOVE) {
+    link_child(win, parent);
+    return;
+  }
+
+  struct FakeWindow* bottom = parent->first_child;
+  while (bottom && bottom->below)
+    bottom = bottom->below;
+  if (!bottom) {
+    link_child(win, parent);
+    return;
+  }
+  bottom->below = win;
+  win->above = bottom;
+}
+
+static struct FakeWindow*
+window_new(xcb_window_t id,
+           struct FakeWindow* parent,
+           int16_t x,
+           int16_t y,
+           uint16_t width,
+           uint16_t height,
+           uint16_t border_width)
+{
+  struct FakeWindow* win = calloc(1, sizeof(*win));
+  if (!win)
+    die("Failed to allocate fake window");
+
+  win->id = id;
+  win->x = x;
+  win->y = y;
+  win->width = width;
+  win->height = height;
+  win->border_width = border_width;
+  link_child(win, parent);
+  hash_insert(win);
+  return win;
+}
+
+// Destroying a window takes its subwindows along, as on a real server
+static void
+window_destroy(struct FakeWindow* win)
+{
+  while (win->first_child)
+    window_destroy(win->first_child);
+
+  unlink_child(win);
+  hash_remove(win);
+  free(win->name);
+  free(win);
+}
+
+// Apply the window attributes the model keeps track of
+static void
+set_attributes(struct FakeWindow* win, uint32_t mask, const uint32_t* values)
+{
+  for (uint32_t bit = 1; mask; bit <<= 1) {
+    if (!(mask & bit))
+      continue;
+    mask &= ~bit;
+    if (bit == XCB_CW_OVERRIDE_REDIRECT)
+      win->override_redirect = *values;
+    else if (bit == XCB_CW_BORDER_PIXEL)
+      win->border_pixel = *values;
+    else if (bit == XCB_CW_EVENT_MASK)
+      win->event_mask = *values;
+    values++;
+  }
+}
+
+static void*
+reply_new(size_t size)
+{
+  // Replies are never shorter than 32 bytes, length counts the words
+  // past those. Every reply starts with response type 1.
+  xcb_generic_reply_t* reply = calloc(1, size > 32 ? size : 32);
+  if (!reply)
+    die("Failed to allocate fake reply");
+
+  reply->response_type = 1;
+  reply->length = size > 32 ? (size - 32 + 3) / 4 : 0;
+  return reply;
+}
+
+static xcb_generic_error_t*
+error_new(uint8_t code, uint32_t resource)
+{
+  xcb_generic_error_t* error = calloc(1, sizeof(*error));
+  if (!error)
+    die("Failed to allocate fake error");
+
+  error->error_code = code;
+  error->resource_id = resource;
+  return error;
+}
+
+// Queue a reply or error, returns the sequence number it is fetched by
+static unsigned int
+answer(void* reply, xcb_generic_error_t* error)
+{
+  unsigned int request = ++sequence;
+  if (reply)
+    ((xcb_generic_reply_t*)reply)->sequence = request;
+  if (error)
+    error->sequence = request;
+
+  if (fake_replies.count == fake_replies.capacity)
+    grow((void**)&fake_replies.items,
+         &fake_replies.capacity,
+         sizeof(struct FakeReply));
+  fake_replies.items[fake_replies.count++] =
+    (struct FakeReply){ request, reply, error };
+  return request;
+}
+
+// Replies are almost always fetched in request order, so the search
+// rarely goes past the first one
+static void
+take(unsigned int request, void** reply, xcb_generic_error_t** error)
+{
+  void* found = NULL;
+  xcb_generic_error_t* e = NULL;
+
+  for (int i = fake_replies.head; i < fake_replies.count; i++) {
+    struct FakeReply* r = &fake_replies.items[i];
+    if (r->sequence == request) {
+      found = r->reply;
+      e = r->error;
+      r->sequence = 0;
+      break;
+    }
+  }
+
+  while (fake_replies.head < fake_replies.count &&
+         !fake_replies.items[fake_replies.head].sequence)
+    fake_replies.head++;
+  if (fake_replies.head == fake_replies.count)
+    fake_replies.head = fake_replies.count = 0;
+
+  *reply = found;
+  if (error)
+    *error = e;
+  else
+    free(e);
+}
+
+// Parents come before their children, siblings bottom to top, so
+// loading in order rebuilds the stacking
+static void
+save_tree(FILE* f, struct FakeWindow* win)
+{
+  struct FakeSavedWindow saved = {
+    .id = win->id,
+    .parent = win->parent,
+    .x = win->x,
+    .y = win->y,
+    .width = win->width,
+    .height = win->height,
+    .border_width = win->border_width,
+    .mapped = win->mapped,
+    .override_redirect = win->override_redirect,
+    .border_pixel = win->border_pixel,
+    .event_mask = win->event_mask,
+    .name_len = win->name ? strlen(win->name) : 0,
+  };
+  fwrite(&saved, sizeof(saved), 1, f);
+  if (saved.name_len)
+    fwrite(win->name, 1, saved.name_len, f);
+
+  struct FakeWindow* bottom = win->first_child;
+  while (bottom && bottom->below)
+    bottom = bottom->below;
+  for (struct FakeWindow* c = bottom; c; c = c->above)
+    save_tree(f, c);
+}
+
+// Write the model to a memfd that survives exec and name it in the
+// environment, so a new process connecting finds the windows retained
+static void
+save_handover(void)
+{
+  int fd = memfd_create("fake-x-server", 0);
+  FILE* f = fd >= 0 ? fdopen(dup(fd), "w") : NULL;
+  if (!f)
+    die("Failed to hand over the fake server");
+
+  uint32_t header[] = { HANDOVER_MAGIC, next_id, next_client };
+  fwrite(header, sizeof(header), 1, f);
+  save_tree(f, find(FAKE_ROOT));
+  if (fclose(f) || lseek(fd, 0, SEEK_SET) < 0)
+    die("Failed to hand over the fake server");
+
+  char value[16];
+  snprintf(value, sizeof(value), "%d", fd);
+  setenv(XREQ_FAKE_HANDOVER, value, 1);
+}
+
+static void
+load_handover(const char* value)
+{
+  FILE* f = fdopen(atoi(value), "r");
+  uint32_t header[3];
+  if (!f || fread(header, sizeof(header), 1, f) != 1 ||
+      header[0] != HANDOVER_MAGIC)
+    die("Failed to take over the fake server");
+  next_id = header[1];
+  next_client = header[2];
+
+  struct FakeSavedWindow saved;
+  while (fread(&saved, sizeof(saved), 1, f) == 1) {
+    struct FakeWindow* win = window_new(saved.id,
+                                        find(saved.parent),
+                                        saved.x,
+                                        saved.y,
+                                        saved.width,
+                                        saved.height,
+                                        saved.border_width);
+    win->mapped = saved.mapped;
+    win->override_redirect = saved.override_redirect;
+    win->border_pixel = saved.border_pixel;
+    win->event_mask = saved.event_mask;
+    if (saved.name_len) {
+      win->name = calloc(1, saved.name_len + 1);
+      if (!win->name || fread(win->name, saved.name_len, 1, f) != 1)
+        die("Failed to take over the fake server");
+    }
+  }
+  fclose(f);
+  unsetenv(XREQ_FAKE_HANDOVER);
+}
+
+static xcb_connection_t*
+connect_display(void)
+{
+  const char* handover = getenv(XREQ_FAKE_HANDOVER);
+  if (!find(FAKE_ROOT) && handover)
+    load_handover(handover);
+
+  if (!find(FAKE_ROOT)) {
+    struct FakeWindow* root = window_new(FAKE_ROOT,
+                                         NULL,
+                                         0,
+                                         0,
+                                         fake_screen.width_in_pixels,
+                                         fake_screen.height_in_pixels,
+                                         0);
+    root->mapped = true;
+  }
+  return NULL;
+}
+
+static int
+connection_has_error(xcb_connection_t* conn)
+{
+  (void)conn;
+  return 0;
+}
+
+static void
+disconnect(xcb_connection_t* conn)
+{
+  (void)conn;
+}
+
+static int
+get_file_descriptor(xcb_connection_t* conn)
+{
+  (void)conn;
+  return -1;
+}
+
+static xcb_screen_t*
+screen(xcb_connection_t* conn)
+{
+  (void)conn;
+  return &fake_screen;
+}
+
+static uint32_t
+generate_id(xcb_connection_t* conn)
+{
+  (void)conn;
+  return next_id++;
+}
+
+static const xcb_query_extension_reply_t*
+get_extension_data(xcb_connection_t* conn, xcb_extension_t* ext)
+{
+  static const xcb_query_extension_reply_t absent = { .present = 0 };
+
+  (void)conn;
+  (void)ext;
+  return &absent;
+}
+
+static xcb_generic_event_t*
+poll_for_event(xcb_connection_t* conn)
+{
+  (void)conn;
+  if (fake_events.head == fake_events.count) {
+    fake_events.head = fake_events.count = 0;
+    return NULL;
+  }
+  return fake_events.items[fake_events.head++];
+}
+
+static void
+flush(xcb_connection_t* conn)
+{
+  (void)conn;
+}
+
+static void*
+wait_for_reply(xcb_connection_t* conn,
+               unsigned int request,
+               xcb_generic_error_t** error)
+{
+  void* reply;
+
+  (void)conn;
+  take(request, &reply, error);
+  return reply;
+}
+
+static int
+poll_for_reply(xcb_connection_t* conn,
+               unsigned int request,
+               void** reply,
+               xcb_generic_error_t** error)
+{
+  (void)conn;
+  take(request, reply, error);
+  return 1;
+}
+
+static void
+allow_events(xcb_connection_t* conn, uint8_t mode, xcb_timestamp_t time)
+{
+  (void)conn;
+  (void)mode;
+  (void)time;
+  note(XCB_ALLOW_EVENTS, 0);
+}
+
+static void
+change_gc(xcb_connection_t* conn,
+          xcb_gcontext_t gc,
+          uint32_t value_mask,
+          const uint32_t* values)
+{
+  (void)conn;
+  (void)value_mask;
+  (void)values;
+  note(XCB_CHANGE_GC, gc);
+}
+
+static void
+change_save_set(xcb_connection_t* conn, uint8_t mode, xcb_window_t window)
+{
+  (void)conn;
+  (void)mode;
+  note(XCB_CHANGE_SAVE_SET, window);
+}
+
+static void
+change_window_attributes(xcb_connection_t* conn,
+                         xcb_window_t window,
+                         uint32_t value_mask,
+                         const uint32_t* values)
+{
+  (void)conn;
+  note(XCB_CHANGE_WINDOW_ATTRIBUTES, window);
+
+  struct FakeWindow* win = find(window);
+  if (win)
+    set_attributes(win, value_mask, values);
+}
+
+static void
+clear_area(xcb_connection_t* conn,
+           uint8_t exposures,
+           xcb_window_t window,
+           int16_t x,
+           int16_t y,
+           uint16_t width,
+           uint16_t height)
+{
+  (void)conn;
+  (void)exposures;
+  (void)x;
+  (void)y;
+  (void)width;
+  (void)height;
+  note(XCB_CLEAR_AREA, window);
+}
+
+static void
+configure_window(xcb_connection_t* conn,
+                 xcb_window_t window,
+                 uint16_t value_mask,
+                 const uint32_t* values)
+{
+  (void)conn;
+  note(XCB_CONFIGURE_WINDOW, window);
+
+  struct FakeWindow* win = find(window);
+  if (!win)
+    return;
+
+  // Values come in mask bit order. Only stacking above or below all
+  // siblings is modelled.
+  if (value_mask & XCB_CONFIG_WINDOW_X)
+    win->x = *values++;
+  if (value_mask & XCB_CONFIG_WINDOW_Y)
+    win->y = *values++;
+  if (value_mask & XCB_CONFIG_WINDOW_WIDTH)
+    win->width = *values++;
+  if (value_mask & XCB_CONFIG_WINDOW_HEIGHT)
+    win->height = *values++;
+  if (value_mask & XCB_CONFIG_WINDOW_BORDER_WIDTH)
+    win->border_width = *values++;
+  if (value_mask & XCB_CONFIG_WINDOW_SIBLING)
+    values++;
+  if (value_mask & XCB_CONFIG_WINDOW_STACK_MODE)
+    restack(win, *values);
+}
+
+static void
+create_gc(xcb_connection_t* conn,
+          xcb_gcontext_t gc,
+          xcb_drawable_t drawable,
+          uint32_t value_mask,
+          const uint32_t* values)
+{
+  (void)conn;
+  (void)drawable;
+  (void)value_mask;
+  (void)values;
+  note(XCB_CREATE_GC, gc);
+}
+
+static void
+create_pixmap(xcb_connection_t* conn,
+              uint8_t depth,
+              xcb_pixmap_t pixmap,
+              xcb_drawable_t drawable,
+              uint16_t width,
+              uint16_t height)
+{
+  (void)conn;
+  (void)depth;
+  (void)drawable;
+  (void)width;
+  (void)height;
+  note(XCB_CREATE_PIXMAP, pixmap);
+}
+
+static void
+create_window(xcb_connection_t* conn,
+              uint8_t depth,
+              xcb_window_t window,
+              xcb_window_t parent,
+              int16_t x,
+              int16_t y,
+              uint16_t width,
+              uint16_t height,
+              uint16_t border_width,
+              uint16_t class,
+              xcb_visualid_t visual,
+              uint32_t value_mask,
+              const uint32_t* values)
+{
+  (void)conn;
+  (void)depth;
+  (void)class;
+  (void)visual;
+  note(XCB_CREATE_WINDOW, window);
+
+  struct FakeWindow* p = find(parent);
+  if (!p || find(window))
+    return;
+
+  struct FakeWindow* win =
+    window_new(window, p, x, y, width, height, border_width);
+  set_attributes(win, value_mask, values);
+}
+
+static void
+destroy_window(xcb_connection_t* conn, xcb_window_t window)
+{
+  (void)conn;
+  note(XCB_DESTROY_WINDOW, window);
+
+  struct FakeWindow* win = find(window);
+  if (win && window != FAKE_ROOT)
+    window_destroy(win);
+}
+
+static void
+free_pixmap(xcb_connection_t* conn, xcb_pixmap_t pixmap)
+{
+  (void)conn;
+  note(XCB_FREE_PIXMAP, pixmap);
+}
+
+static void
+grab_button(xcb_connection_t* conn,
+            uint8_t owner_events,
+            xcb_window_t window,
+            uint16_t event_mask,
+            uint8_t pointer_mode,
+            uint8_t keyboard_mode,
+            xcb_window_t confine_to,
+            xcb_cursor_t cursor,
+            uint8_t button,
+            uint16_t modifiers)
+{
+  (void)conn;
+  (void)owner_events;
+  (void)event_mask;
+  (void)pointer_mode;
+  (void)keyboard_mode;
+  (void)confine_to;
+  (void)cursor;
+  (void)button;
+  (void)modifiers;
+  note(XCB_GRAB_BUTTON, window);
+}
+
+static void
+image_text_8(xcb_connection_t* conn,
+             uint8_t len,
+             xcb_drawable_t drawable,
+             xcb_gcontext_t gc,
+             int16_t x,
+             int16_t y,
+             const char* text)
+{
+  (void)conn;
+  (void)gc;
+  (void)x;
+  (void)y;
+  note(XCB_IMAGE_TEXT_8, drawable);
+
+  memcpy(drawn_text, text, len);
+  drawn_text[len] = '\0';
+}
+
+static void
+kill_client(xcb_connection_t* conn, uint32_t resource)
+{
+  (void)conn;
+  note(XCB_KILL_CLIENT, resource);
+}
+
+static void
+map_window(xcb_connection_t* conn, xcb_window_t window)
+{
+  (void)conn;
+  note(XCB_MAP_WINDOW, window);
+
+  struct FakeWindow* win = find(window);
+  if (win)
+    win->mapped = true;
+}
+
+static void
+open_font(xcb_connection_t* conn,
+          xcb_font_t font,
+          uint16_t len,
+          const char* name)
+{
+  (void)conn;
+  (void)len;
+  (void)name;
+  note(XCB_OPEN_FONT, font);
+}
+
+static void
+poly_fill_rectangle(xcb_connection_t* conn,
+                    xcb_drawable_t drawable,
+                    xcb_gcontext_t gc,
+                    uint32_t count,
+                    const xcb_rectangle_t* rects)
+{
+  (void)conn;
+  (void)gc;
+  (void)count;
+  (void)rects;
+  note(XCB_POLY_FILL_RECTANGLE, drawable);
+}
+
+static void
+reparent_window(xcb_connection_t* conn,
+                xcb_window_t window,
+                xcb_window_t parent,
+                int16_t x,
+                int16_t y)
+{
+  (void)conn;
+  note(XCB_REPARENT_WINDOW, window);
+
+  struct FakeWindow* win = find(window);
+  struct FakeWindow* p = find(parent);
+  if (!win || !p)
+    return;
+
+  unlink_child(win);
+  link_child(win, p);
+  win->x = x;
+  win->y = y;
+}
+
+static void
+send_event(xcb_connection_t* conn,
+           uint8_t propagate,
+           xcb_window_t destination,
+           uint32_t event_mask,
+           const char* event)
+{
+  (void)conn;
+  (void)propagate;
+  (void)event_mask;
+  (void)event;
+  note(XCB_SEND_EVENT, destination);
+}
+
+static void
+set_close_down_mode(xcb_connection_t* conn, uint8_t mode)
+{
+  (void)conn;
+  note(XCB_SET_CLOSE_DOWN_MODE, 0);
+
+  if (mode == XCB_CLOSE_DOWN_RETAIN_PERMANENT)
+    save_handover();
+  else
+    unsetenv(XREQ_FAKE_HANDOVER);
+}
+
+static void
+unmap_window(xcb_connection_t* conn, xcb_window_t window)
+{
+  (void)conn;
+  note(XCB_UNMAP_WINDOW, window);
+
+  struct FakeWindow* win = find(window);
+  if (win)
+    win->mapped = false;
+}
+
+static unsigned int
+get_geometry(xcb_connection_t* conn, xcb_drawable_t drawable)
+{
+  (void)conn;
+  note(XCB_GET_GEOMETRY, drawable);
+
+  struct FakeWindow* win = find(drawable);
+  if (!win)
+    return answer(NULL, error_new(XCB_DRAWABLE, drawable));
+
+  xcb_get_geometry_reply_t* reply = reply_new(sizeof(*reply));
+  reply->depth = fake_screen.root_depth;
+  reply->root = FAKE_ROOT;
+  reply->x = win->x;
+  reply->y = win->y;
+  reply->width = win->width;
+  reply->height = win->height;
+  reply->border_width = win->border_width;
+  return answer(reply, NULL);
+}
+
+static unsigned int
+get_input_focus(xcb_connection_t* conn)
+{
+  (void)conn;
+  note(XCB_GET_INPUT_FOCUS, 0);
+
+  xcb_get_input_focus_reply_t* reply = reply_new(sizeof(*reply));
+  reply->revert_to = XCB_INPUT_FOCUS_POINTER_ROOT;
+  reply->focus = FAKE_ROOT;
+  return answer(reply, NULL);
+}
+
+// Only WM_NAME has a value, every other property is unset
+static unsigned int
+get_property(xcb_connection_t* conn,
+             uint8_t delete,
+             xcb_window_t window,
+             xcb_atom_t property,
+             xcb_atom_t type,
+             uint32_t offset,
+             uint32_t length)
+{
+  (void)conn;
+  (void)delete;
+  note(XCB_GET_PROPERTY, window);
+
+  struct FakeWindow* win = find(window);
+  if (!win)
+    return answer(NULL, error_new(XCB_WINDOW, window));
+
+  const char* value = property == XCB_ATOM_WM_NAME ? win->name : NULL;
+  bool match = type == XCB_GET_PROPERTY_TYPE_ANY || type == XCB_ATOM_STRING;
+  size_t len = value ? strlen(value) : 0;
+  size_t start = (size_t)offset * 4 < len ? (size_t)offset * 4 : len;
+  size_t room = (size_t)length * 4;
+  size_t n = match ? (len - start < room ? len - start : room) : 0;
+
+  xcb_get_property_reply_t* reply = reply_new(sizeof(*reply) + n);
+  if (value) {
+    reply->format = 8;
+    reply->type = XCB_ATOM_STRING;
+    reply->bytes_after = len - start - n;
+    reply->value_len = n;
+    memcpy(reply + 1, value + start, n);
+  }
+  return answer(reply, NULL);
+}
+
+static unsigned int
+get_window_attributes(xcb_connection_t* conn, xcb_window_t window)
+{
+  (void)conn;
+  note(XCB_GET_WINDOW_ATTRIBUTES, window);
+
+  struct FakeWindow* win = find(window);
+  if (!win)
+    return answer(NULL, error_new(XCB_WINDOW, window));
+
+  xcb_get_window_attributes_reply_t* reply = reply_new(sizeof(*reply));
+  reply->visual = fake_screen.root_visual;
+  reply->_class = XCB_WINDOW_CLASS_INPUT_OUTPUT;
+  reply->map_is_installed = 1;
+  reply->map_state =
+    win->mapped ? XCB_MAP_STATE_VIEWABLE : XCB_MAP_STATE_UNMAPPED;
+  reply->override_redirect = win->override_redirect;
+  reply->colormap = fake_screen.default_colormap;
+  reply->your_event_mask = win->event_mask;
+  return answer(reply, NULL);
+}
+
+static unsigned int
+intern_atom(xcb_connection_t* conn,
+            uint8_t only_if_exists,
+            uint16_t len,
+            const char* name)
+{
+  (void)conn;
+  (void)only_if_exists;
+  note(XCB_INTERN_ATOM, 0);
+
+  int i = 0;
+  while (i < fake_atoms.count && (strlen(fake_atoms.names[i]) != len ||
+                                  memcmp(fake_atoms.names[i], name, len)))
+    i++;
+
+  if (i == fake_atoms.count) {
+    if (fake_atoms.count == fake_atoms.capacity)
+      grow((void**)&fake_atoms.names, &fake_atoms.capacity, sizeof(char*));
+    fake_atoms.names[fake_atoms.count] = strndup(name, len);
+    if (!fake_atoms.names[fake_atoms.count++])
+      die("Failed to allocate fake atom");
+  }
+
+  xcb_intern_atom_reply_t* reply = reply_new(sizeof(*reply));
+  reply->atom = FIRST_ATOM + i;
+  return answer(reply, NULL);
+}
+
+// A fixed cell font, as the wm only looks at the metrics
+static unsigned int
+query_font(xcb_connection_t* conn, xcb_fontable_t font)
+{
+  (void)conn;
+  note(XCB_QUERY_FONT, font);
+
+  xcb_query_font_reply_t* reply = reply_new(sizeof(*reply));
+  reply->min_bounds.character_width = 6;
+  reply->max_bounds.character_width = 6;
+  reply->min_char_or_byte2 = 0;
+  reply->max_char_or_byte2 = 255;
+  reply->font_ascent = 10;
+  reply->font_descent = 3;
+  return answer(reply, NULL);
+}
+
+// Children are listed bottom to top
+static unsigned int
+query_tree(xcb_connection_t* conn, xcb_window_t window)
+{
+  (void)conn;
+  note(XCB_QUERY_TREE, window);
+
+  struct FakeWindow* win = find(window);
+  if (!win)
+    return answer(NULL, error_new(XCB_WINDOW, window));
+
+  int count = 0;
+  struct FakeWindow* bottom = NULL;
+  for (struct FakeWindow* c = win->first_child; c; c = c->below) {
+    bottom = c;
+    count++;
+  }
+
+  xcb_query_tree_reply_t* reply =
+    reply_new(sizeof(*reply) + sizeof(xcb_window_t) * count);
+  reply->root = FAKE_ROOT;
+  reply->parent = win->parent;
+  reply->children_len = count;
+
+  xcb_window_t* children = xcb_query_tree_children(reply);
+  for (struct FakeWindow* c = bottom; c; c = c->above)
+    *children++ = c->id;
+  return answer(reply, NULL);
+}
+
+const struct XreqBackend xreq_fake = {
+  .connect = connect_display,
+  .connection_has_error = connection_has_error,
+  .disconnect = disconnect,
+  .get_file_descriptor = get_file_descriptor,
+  .screen = screen,
+  .generate_id = generate_id,
+  .get_extension_data = get_extension_data,
+  .poll_for_event = poll_for_event,
+  .flush = flush,
+  .wait_for_reply = wait_for_reply,
+  .poll_for_reply = poll_for_reply,
+  .allow_events = allow_events,
+  .change_gc = change_gc,
+  .change_save_set = change_save_set,
+  .change_window_attributes = change_window_attributes,
+  .clear_area = clear_area,
+  .configure_window = configure_window,
+  .create_gc = create_gc,
+  .create_pixmap = create_pixmap,
+  .create_window = create_window,
+  .destroy_window = destroy_window,
+  .free_pixmap = free_pixmap,
+  .grab_button = grab_button,
+  .image_text_8 = image_text_8,
+  .kill_client = kill_client,
+  .map_window = map_window,
+  .open_font = open_font,
+  .poly_fill_rectangle = poly_fill_rectangle,
+  .reparent_window = reparent_window,
+  .send_event = send_event,
+  .set_close_down_mode = set_close_down_mode,
+  .unmap_window = unmap_window,
+  .get_geometry = get_geometry,
+  .get_input_focus = get_input_focus,
+  .get_property = get_property,
+  .get_window_attributes = get_window_attributes,
+  .intern_atom = intern_atom,
+  .query_font = query_font,
+  .query_tree = query_tree,
+};
+
+xcb_window_t
+xreq_fake_create_client(const char* name,
+                        int16_t x,
+                        int16_t y,
+                        uint16_t width,
+                        uint16_t height)
+{
+  connect_display();
+
+  struct FakeWindow* win =
+    window_new(next_client++, find(FAKE_ROOT), x, y, width, height, 0);
+  if (name && !(win->name = strdup(name)))
+    die("Failed to allocate fake window name");
+  return win->id;
+}
+
+void
+xreq_fake_destroy_client(xcb_window_t window)
+{
+  struct FakeWindow* win = find(window);
+  if (!win)
+    return;
+
+  xcb_generic_event_t ev = { 0 };
+  xcb_destroy_notify_event_t* destroy = (xcb_destroy_notify_event_t*)&ev;
+  destroy->response_type = XCB_DESTROY_NOTIFY;
+  destroy->event = win->parent;
+  destroy->window = window;
+  window_destroy(win);
+  xreq_fake_push_event(&ev);
+}
+
+void
+xreq_fake_map_request(xcb_window_t window)
+{
+  const struct FakeWindow* win = find(window);
+  xcb_generic_event_t ev = { 0 };
+  xcb_map_request_event_t* map = (xcb_map_request_event_t*)&ev;
+  map->response_type = XCB_MAP_REQUEST;
+  map->parent = win ? win->parent : FAKE_ROOT;
+  map->window = window;
+  xreq_fake_push_event(&ev);
+}
+
+void
+xreq_fake_push_event(const void* ev)
+{
+  xcb_generic_event_t* copy = calloc(1, sizeof(*copy));
+  if (!copy)
+    die("Failed to allocate fake event");
+  memcpy(copy, ev, 32);
+
+  if (fake_events.count == fake_events.capacity)
+    grow((void**)&fake_events.items,
+         &fake_events.capacity,
+         sizeof(xcb_generic_event_t*));
+  fake_events.items[fake_events.count++] = copy;
+}
+
+const struct FakeWindow*
+xreq_fake_window(xcb_window_t window)
+{
+  connect_display();
+  return find(window);
+}
+
+const char*
+xreq_fake_drawn_text(void)
+{
+  return drawn_text;
+}
+
+uint64_t
+xreq_fake_count(uint8_t opcode)
+{
+  return counts[opcode];
+}
+
+const struct FakeRequest*
+xreq_fake_request(unsigned int back)
+{
+  if (back >= FAKE_LOG_SIZE || back >= logged)
+    return NULL;
+  return &request_log[(logged - 1 - back) % FAKE_LOG_SIZE];
+}
+
+void
+xreq_fake_reset(void)
+{
+  memset(counts, 0, sizeof(counts));
+  logged = 0;
+}
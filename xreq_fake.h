@@ -0,0 +1,95 @@
+#ifndef XREQ_FAKE_H
+#define XREQ_FAKE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xcb/xcb.h>
+
+#include "xreq.h"
+
+// An X server inside the process, so the wm can be driven and measured
+// without one. Requests update a model of the window tree and queries are
+// answered from it at once, so replies never keep anyone waiting. Every
+// request is counted by opcode and the latest ones are kept. The only
+// events are the ones queued through the calls below, RandR is absent.
+//
+// Setting the close down mode to RetainPermanent hands the window tree
+// over through a memfd named by XREQ_FAKE_HANDOVER, so a restart that
+// execs finds its frames again on the next connect.
+
+extern const struct XreqBackend xreq_fake;
+
+#define FAKE_ROOT 0x100
+#define FAKE_LOG_SIZE 256
+#define XREQ_FAKE_HANDOVER "XREQ_FAKE_HANDOVER"
+
+struct FakeWindow
+{
+  xcb_window_t id;
+  xcb_window_t parent;
+  int16_t x, y; // Relative to the parent
+  uint16_t width, height;
+  uint16_t border_width;
+  bool mapped;
+  bool override_redirect;
+  uint32_t border_pixel;
+  uint32_t event_mask;
+  char* name; // WM_NAME, NULL if unset
+
+  // Model internals
+  struct FakeWindow* first_child;  // Topmost child
+  struct FakeWindow* above;        // Sibling stacked above
+  struct FakeWindow* below;        // Sibling stacked below
+  struct FakeWindow* next_in_hash; // Bucket chain
+};
+
+struct FakeRequest
+{
+  uint8_t opcode;  // Core protocol opcode, XCB_MAP_WINDOW and so on
+  uint32_t target; // Window or other resource acted on, 0 for none
+};
+
+// Create an unmapped top level window the way a client would. name
+// becomes its WM_NAME and may be NULL.
+xcb_window_t
+xreq_fake_create_client(const char* name,
+                        int16_t x,
+                        int16_t y,
+                        uint16_t width,
+                        uint16_t height);
+
+// Destroy a client window and queue the DestroyNotify the wm gets
+void
+xreq_fake_destroy_client(xcb_window_t window);
+
+// Queue the MapRequest a client asking to be mapped causes
+void
+xreq_fake_map_request(xcb_window_t window);
+
+// Queue an event, the first 32 bytes of ev are used
+void
+xreq_fake_push_event(const void* ev);
+
+// Current state of window, NULL if it does not exist. The root and its
+// subwindows are created or taken over on first use.
+const struct FakeWindow*
+xreq_fake_window(xcb_window_t window);
+
+// Text the latest ImageText8 drew, "" before the first
+const char*
+xreq_fake_drawn_text(void);
+
+// Requests with opcode sent since the last reset
+uint64_t
+xreq_fake_count(uint8_t opcode);
+
+// Request sent back requests before the latest, NULL once it is out of
+// the log
+const struct FakeRequest*
+xreq_fake_request(unsigned int back);
+
+// Forget the counts and the log, the model stays
+void
+xreq_fake_reset(void);
+
+#endif /* XREQ_FAKE_H */
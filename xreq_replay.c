@@ -0,0 +1,227 @@
+#include <stdlib.h>
+
+#include "trace.h"
+#include "xreq.h"
+
+// Everything the server would hand back comes from the trace, in the
+// order it was recorded. Cookies only need to be distinct.
+
+static unsigned int sequence = 1;
+
+static xcb_connection_t*
+connect_display(void)
+{
+  return NULL;
+}
+
+static int
+connection_has_error(xcb_connection_t* conn)
+{
+  (void)conn;
+  return trace_done();
+}
+
+static void
+disconnect(xcb_connection_t* conn)
+{
+  (void)conn;
+}
+
+static int
+get_file_descriptor(xcb_connection_t* conn)
+{
+  (void)conn;
+  return -1;
+}
+
+static xcb_screen_t*
+screen(xcb_connection_t* conn)
+{
+  static xcb_screen_t replayed;
+
+  (void)conn;
+  trace_value(TRACE_SCREEN, &replayed, sizeof(replayed));
+  return &replayed;
+}
+
+static uint32_t
+generate_id(xcb_connection_t* conn)
+{
+  uint32_t id = 0;
+
+  (void)conn;
+  trace_value(TRACE_ID, &id, sizeof(id));
+  return id;
+}
+
+static const xcb_query_extension_reply_t*
+get_extension_data(xcb_connection_t* conn, xcb_extension_t* ext)
+{
+  static xcb_query_extension_reply_t replayed;
+
+  (void)conn;
+  (void)ext;
+  trace_value(TRACE_EXTENSION, &replayed, sizeof(replayed));
+  return &replayed;
+}
+
+static xcb_generic_event_t*
+poll_for_event(xcb_connection_t* conn)
+{
+  (void)conn;
+  return trace_replay_event();
+}
+
+static void
+flush(xcb_connection_t* conn)
+{
+  (void)conn;
+}
+
+static int
+poll_for_reply(xcb_connection_t* conn,
+               unsigned int request,
+               void** reply,
+               xcb_generic_error_t** error)
+{
+  xcb_generic_error_t* e = NULL;
+
+  (void)conn;
+  (void)request;
+  int result = trace_replay_reply(reply, &e);
+  if (error)
+    *error = e;
+  else
+    free(e);
+  return result;
+}
+
+static void*
+wait_for_reply(xcb_connection_t* conn,
+               unsigned int request,
+               xcb_generic_error_t** error)
+{
+  void* reply = NULL;
+  poll_for_reply(conn, request, &reply, error);
+  return reply;
+}
+
+static unsigned int
+get_geometry(xcb_connection_t* conn, xcb_drawable_t drawable)
+{
+  (void)conn;
+  (void)drawable;
+  return sequence++;
+}
+
+static unsigned int
+get_input_focus(xcb_connection_t* conn)
+{
+  (void)conn;
+  return sequence++;
+}
+
+static unsigned int
+get_property(xcb_connection_t* conn,
+             uint8_t delete,
+             xcb_window_t window,
+             xcb_atom_t property,
+             xcb_atom_t type,
+             uint32_t offset,
+             uint32_t length)
+{
+  (void)conn;
+  (void)delete;
+  (void)window;
+  (void)property;
+  (void)type;
+  (void)offset;
+  (void)length;
+  return sequence++;
+}
+
+static unsigned int
+get_window_attributes(xcb_connection_t* conn, xcb_window_t window)
+{
+  (void)conn;
+  (void)window;
+  return sequence++;
+}
+
+static unsigned int
+intern_atom(xcb_connection_t* conn,
+            uint8_t only_if_exists,
+            uint16_t len,
+            const char* name)
+{
+  (void)conn;
+  (void)only_if_exists;
+  (void)len;
+  (void)name;
+  return sequence++;
+}
+
+static unsigned int
+query_font(xcb_connection_t* conn, xcb_fontable_t font)
+{
+  (void)conn;
+  (void)font;
+  return sequence++;
+}
+
+static unsigned int
+query_tree(xcb_connection_t* conn, xcb_window_t window)
+{
+  (void)conn;
+  (void)window;
+  return sequence++;
+}
+
+#ifdef HAVE_RANDR
+static unsigned int
+randr_get_monitors(xcb_connection_t* conn,
+                   xcb_window_t window,
+                   uint8_t get_active)
+{
+  (void)conn;
+  (void)window;
+  (void)get_active;
+  return sequence++;
+}
+
+static unsigned int
+randr_query_version(xcb_connection_t* conn,
+                    uint32_t major_version,
+                    uint32_t minor_version)
+{
+  (void)conn;
+  (void)major_version;
+  (void)minor_version;
+  return sequence++;
+}
+#endif
+
+const struct XreqBackend xreq_replay = {
+  .connect = connect_display,
+  .connection_has_error = connection_has_error,
+  .disconnect = disconnect,
+  .get_file_descriptor = get_file_descriptor,
+  .screen = screen,
+  .generate_id = generate_id,
+  .get_extension_data = get_extension_data,
+  .poll_for_event = poll_for_event,
+  .flush = flush,
+  .wait_for_reply = wait_for_reply,
+  .poll_for_reply = poll_for_reply,
+  .get_geometry = get_geometry,
+  .get_input_focus = get_input_focus,
+  .get_property = get_property,
+  .get_window_attributes = get_window_attributes,
+  .intern_atom = intern_atom,
+  .query_font = query_font,
+  .query_tree = query_tree,
+#ifdef HAVE_RANDR
+  .randr_get_monitors = randr_get_monitors,
+  .randr_query_version = randr_query_version,
+#endif
+};
@@ -0,0 +1,362 @@
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+
+#include "xreq.h"
+
+// Straight through to the X server
+
+static xcb_connection_t*
+connect_display(void)
+{
+  return xcb_connect(NULL, NULL);
+}
+
+static xcb_screen_t*
+screen(xcb_connection_t* conn)
+{
+  return xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+}
+
+static void
+flush(xcb_connection_t* conn)
+{
+  xcb_flush(conn);
+}
+
+static void
+allow_events(xcb_connection_t* conn, uint8_t mode, xcb_timestamp_t time)
+{
+  xcb_allow_events(conn, mode, time);
+}
+
+static void
+change_gc(xcb_connection_t* conn,
+          xcb_gcontext_t gc,
+          uint32_t value_mask,
+          const uint32_t* values)
+{
+  xcb_change_gc(conn, gc, value_mask, values);
+}
+
+static void
+change_save_set(xcb_connection_t* conn, uint8_t mode, xcb_window_t window)
+{
+  xcb_change_save_set(conn, mode, window);
+}
+
+static void
+change_window_attributes(xcb_connection_t* conn,
+                         xcb_window_t window,
+                         uint32_t value_mask,
+                         const uint32_t* values)
+{
+  xcb_change_window_attributes(conn, window, value_mask, values);
+}
+
+static void
+clear_area(xcb_connection_t* conn,
+           uint8_t exposures,
+           xcb_window_t window,
+           int16_t x,
+           int16_t y,
+           uint16_t width,
+           uint16_t height)
+{
+  xcb_clear_area(conn, exposures, window, x, y, width, height);
+}
+
+static void
+configure_window(xcb_connection_t* conn,
+                 xcb_window_t window,
+                 uint16_t value_mask,
+                 const uint32_t* values)
+{
+  xcb_configure_window(conn, window, value_mask, values);
+}
+
+static void
+create_gc(xcb_connection_t* conn,
+          xcb_gcontext_t gc,
+          xcb_drawable_t drawable,
+          uint32_t value_mask,
+          const uint32_t* values)
+{
+  xcb_create_gc(conn, gc, drawable, value_mask, values);
+}
+
+static void
+create_pixmap(xcb_connection_t* conn,
+              uint8_t depth,
+              xcb_pixmap_t pixmap,
+              xcb_drawable_t drawable,
+              uint16_t width,
+              uint16_t height)
+{
+  xcb_create_pixmap(conn, depth, pixmap, drawable, width, height);
+}
+
+static void
+create_window(xcb_connection_t* conn,
+              uint8_t depth,
+              xcb_window_t window,
+              xcb_window_t parent,
+              int16_t x,
+              int16_t y,
+              uint16_t width,
+              uint16_t height,
+              uint16_t border_width,
+              uint16_t class,
+              xcb_visualid_t visual,
+              uint32_t value_mask,
+              const uint32_t* values)
+{
+  xcb_create_window(conn,
+                    depth,
+                    window,
+                    parent,
+                    x,
+                    y,
+                    width,
+                    height,
+                    border_width,
+                    class,
+                    visual,
+                    value_mask,
+                    values);
+}
+
+static void
+destroy_window(xcb_connection_t* conn, xcb_window_t window)
+{
+  xcb_destroy_window(conn, window);
+}
+
+static void
+free_pixmap(xcb_connection_t* conn, xcb_pixmap_t pixmap)
+{
+  xcb_free_pixmap(conn, pixmap);
+}
+
+static void
+grab_button(xcb_connection_t* conn,
+            uint8_t owner_events,
+            xcb_window_t window,
+            uint16_t event_mask,
+            uint8_t pointer_mode,
+            uint8_t keyboard_mode,
+            xcb_window_t confine_to,
+            xcb_cursor_t cursor,
+            uint8_t button,
+            uint16_t modifiers)
+{
+  xcb_grab_button(conn,
+                  owner_events,
+                  window,
+                  event_mask,
+                  pointer_mode,
+                  keyboard_mode,
+                  confine_to,
+                  cursor,
+                  button,
+                  modifiers);
+}
+
+static void
+image_text_8(xcb_connection_t* conn,
+             uint8_t len,
+             xcb_drawable_t drawable,
+             xcb_gcontext_t gc,
+             int16_t x,
+             int16_t y,
+             const char* text)
+{
+  xcb_image_text_8(conn, len, drawable, gc, x, y, text);
+}
+
+static void
+kill_client(xcb_connection_t* conn, uint32_t resource)
+{
+  xcb_kill_client(conn, resource);
+}
+
+static void
+map_window(xcb_connection_t* conn, xcb_window_t window)
+{
+  xcb_map_window(conn, window);
+}
+
+static void
+open_font(xcb_connection_t* conn,
+          xcb_font_t font,
+          uint16_t len,
+          const char* name)
+{
+  xcb_open_font(conn, font, len, name);
+}
+
+static void
+poly_fill_rectangle(xcb_connection_t* conn,
+                    xcb_drawable_t drawable,
+                    xcb_gcontext_t gc,
+                    uint32_t count,
+                    const xcb_rectangle_t* rects)
+{
+  xcb_poly_fill_rectangle(conn, drawable, gc, count, rects);
+}
+
+static void
+reparent_window(xcb_connection_t* conn,
+                xcb_window_t window,
+                xcb_window_t parent,
+                int16_t x,
+                int16_t y)
+{
+  xcb_reparent_window(conn, window, parent, x, y);
+}
+
+static void
+send_event(xcb_connection_t* conn,
+           uint8_t propagate,
+           xcb_window_t destination,
+           uint32_t event_mask,
+           const char* event)
+{
+  xcb_send_event(conn, propagate, destination, event_mask, event);
+}
+
+static void
+set_close_down_mode(xcb_connection_t* conn, uint8_t mode)
+{
+  xcb_set_close_down_mode(conn, mode);
+}
+
+static void
+unmap_window(xcb_connection_t* conn, xcb_window_t window)
+{
+  xcb_unmap_window(conn, window);
+}
+
+static unsigned int
+get_geometry(xcb_connection_t* conn, xcb_drawable_t drawable)
+{
+  return xcb_get_geometry(conn, drawable).sequence;
+}
+
+static unsigned int
+get_input_focus(xcb_connection_t* conn)
+{
+  return xcb_get_input_focus(conn).sequence;
+}
+
+static unsigned int
+get_property(xcb_connection_t* conn,
+             uint8_t delete,
+             xcb_window_t window,
+             xcb_atom_t property,
+             xcb_atom_t type,
+             uint32_t offset,
+             uint32_t length)
+{
+  return xcb_get_property(conn, delete, window, property, type, offset, length)
+    .sequence;
+}
+
+static unsigned int
+get_window_attributes(xcb_connection_t* conn, xcb_window_t window)
+{
+  return xcb_get_window_attributes(conn, window).sequence;
+}
+
+static unsigned int
+intern_atom(xcb_connection_t* conn,
+            uint8_t only_if_exists,
+            uint16_t len,
+            const char* name)
+{
+  return xcb_intern_atom(conn, only_if_exists, len, name).sequence;
+}
+
+static unsigned int
+query_font(xcb_connection_t* conn, xcb_fontable_t font)
+{
+  return xcb_query_font(conn, font).sequence;
+}
+
+static unsigned int
+query_tree(xcb_connection_t* conn, xcb_window_t window)
+{
+  return xcb_query_tree(conn, window).sequence;
+}
+
+#ifdef HAVE_RANDR
+static void
+randr_select_input(xcb_connection_t* conn,
+                   xcb_window_t window,
+                   uint16_t enable)
+{
+  xcb_randr_select_input(conn, window, enable);
+}
+
+static unsigned int
+randr_get_monitors(xcb_connection_t* conn,
+                   xcb_window_t window,
+                   uint8_t get_active)
+{
+  return xcb_randr_get_monitors(conn, window, get_active).sequence;
+}
+
+static unsigned int
+randr_query_version(xcb_connection_t* conn,
+                    uint32_t major_version,
+                    uint32_t minor_version)
+{
+  return xcb_randr_query_version(conn, major_version, minor_version).sequence;
+}
+#endif
+
+const struct XreqBackend xreq_xcb = {
+  .connect = connect_display,
+  .connection_has_error = xcb_connection_has_error,
+  .disconnect = xcb_disconnect,
+  .get_file_descriptor = xcb_get_file_descriptor,
+  .screen = screen,
+  .generate_id = xcb_generate_id,
+  .get_extension_data = xcb_get_extension_data,
+  .poll_for_event = xcb_poll_for_event,
+  .flush = flush,
+  .wait_for_reply = xcb_wait_for_reply,
+  .poll_for_reply = xcb_poll_for_reply,
+  .allow_events = allow_events,
+  .change_gc = change_gc,
+  .change_save_set = change_save_set,
+  .change_window_attributes = change_window_attributes,
+  .clear_area = clear_area,
+  .configure_window = configure_window,
+  .create_gc = create_gc,
+  .create_pixmap = create_pixmap,
+  .create_window = create_window,
+  .destroy_window = destroy_window,
+  .free_pixmap = free_pixmap,
+  .grab_button = grab_button,
+  .image_text_8 = image_text_8,
+  .kill_client = kill_client,
+  .map_window = map_window,
+  .open_font = open_font,
+  .poly_fill_rectangle = poly_fill_rectangle,
+  .reparent_window = reparent_window,
+  .send_event = send_event,
+  .set_close_down_mode = set_close_down_mode,
+  .unmap_window = unmap_window,
+  .get_geometry = get_geometry,
+  .get_input_focus = get_input_focus,
+  .get_property = get_property,
+  .get_window_attributes = get_window_attributes,
+  .intern_atom = intern_atom,
+  .query_font = query_font,
+  .query_tree = query_tree,
+#ifdef HAVE_RANDR
+  .randr_select_input = randr_select_input,
+  .randr_get_monitors = randr_get_monitors,
+  .randr_query_version = randr_query_version,
+#endif
+};